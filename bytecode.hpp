@@ -0,0 +1,103 @@
+#pragma once
+
+#include "value.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cbasic {
+
+// -----------------------------
+// Bytecode
+// -----------------------------
+// Lines are compiled to Code before they run. Words with a dedicated opcode
+// compile to it directly; other builtins go through Op::Call. Typed words
+// pick their opcode statically: ADD works on the tagged data stack, F+ on
+// the float stack, so float opcodes never inspect a type.
+//
+// Jump offsets in `arg` are relative to the jumping instruction, so a block
+// of code can be moved without patching. `slot` names a FOR loop by its
+// distance from the innermost active loop (0 = innermost).
+enum class Op : std::uint8_t {
+    Push,       // push `value` on the data stack
+    Add,        // data stack, int-int fast path; lazy on arrays
+    Sub,
+    Mul,
+    FPush,      // push `value.as_float()` on the float stack
+    FAdd,       // float stack
+    FSub,
+    FMul,
+    FDiv,
+    FPrint,     // F.   pop and print the top of the float stack
+    FDup,
+    FDrop,
+    FSwap,
+    ToFloat,    // >F   data stack -> float stack
+    FromFloat,  // F>   float stack -> data stack
+    Here,       // HERE  ( -- addr )
+    Allot,      // ALLOT ( n -- )
+    Cells,      // CELLS ( n -- n*8 )
+    Fetch,      // @     ( addr -- x )    bounds-checked cell access
+    Store,      // !     ( x addr -- )
+    CFetch,     // C@    ( addr -- c )    bounds-checked byte access
+    CStore,     // C!    ( c addr -- )
+    Jump,       // pc += arg
+    ForBegin,   // ( start limit step -- ) enter a loop, or jump `arg` if it runs zero times
+    Next,       // step loop 0; jump `arg` back while it runs
+    LoopIndex,  // push the index of loop `slot`
+    RangeCheck, // jump `arg` unless array `value` covers every index loop `slot` will take
+    Dim,        // (re)allocate array `arg` with `value` elements, or pop the count if `value` < 0
+    ALoad,      // ( i -- x )  bounds-checked element load from array `arg`
+    AStore,     // ( x i -- )
+    ALoadLoop,  // ( -- x )    unchecked load at loop `slot`'s index, covered by a RangeCheck
+    AStoreLoop, // ( x -- )
+    Map,        // MAP f     ( a -- e )     lazy array expressions, see pipeline.hpp;
+    Zip,        // ZIP f     ( a b -- e )   `arg` is the MapFn, ZipFn or Compare
+    Filter,     // FILTER c  ( a t -- e )
+    Reduce,     // REDUCE f  ( a -- x )     evaluate in one fused pass
+    ASum,       // ASUM  ( a -- x )
+    AMax,       // AMAX  ( a -- x )
+    ADot,       // ADOT  ( a b -- x )
+    AFill,      // AFILL ( a x -- )
+    AIota,      // AIOTA ( a -- )
+    AAssign,    // TO A  ( a' -- )   copy or evaluate a whole array into array `arg`
+    Call,       // builtin number `arg` of the shared dictionary
+    CallLocal,  // builtin number `arg` of the interpreter's own words
+    Exec,       // run colon definition `arg` of the shared dictionary
+    ExecLocal,  // run the interpreter's own colon definition `arg`
+    SaveImage,  // SAVE-IMAGE file: write an image to code.strings[arg]
+    Profile,    // PROFILE command: ProfileCommand `slot`, file name code.strings[arg]
+    Sample,     // SAMPLE command: likewise
+    PerfBegin,  // PERF{  start counting the region named code.strings[arg]
+    PerfEnd,    // }PERF  report it
+    Now,        // NOW    ( -- ns )  a monotonic clock, from process start
+    TimeBegin,  // TIME{  start timing
+    TimeEnd,    // }TIME  ( -- ns )  push the time since the matching TIME{
+    BenchBegin, // BENCH n {  run the block `value` times, named code.strings[arg]
+    BenchEnd,   // }      end a run; jump `arg` back for the next one, or report
+    Error,      // report code.strings[arg]; keep last
+};
+
+struct Instruction {
+    Op op;
+    std::uint16_t slot = 0;
+    std::uint32_t arg = 0;
+    Value value{};
+};
+
+static_assert(sizeof(Instruction) == 16, "instructions should stay two words");
+
+inline constexpr std::uint32_t OP_COUNT = static_cast<std::uint32_t>(Op::Error) + 1;
+
+struct Code {
+    std::vector<Instruction> instructions;
+    std::vector<std::string> strings;  // messages referenced by instructions
+    std::string name;                  // a colon definition's name; empty for a line
+};
+
+// Relative jump offset for an instruction at `from` targeting `to`
+inline std::uint32_t jump_offset(std::size_t from, std::size_t to) {
+    return static_cast<std::uint32_t>(static_cast<std::int32_t>(to) - static_cast<std::int32_t>(from));
+}
+
+} // namespace cbasic
@@ -0,0 +1,255 @@
+#include "cbasic.hpp"
+#include "hash.hpp"
+#include "serial.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <sstream>
+#include <thread>
+
+#if defined(_WIN32)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace cbasic {
+
+// -----------------------------
+// Compiled script cache
+// -----------------------------
+// Like Python's __pycache__: eval(source, cache) keeps each script's
+// compiled lines in `cache`, in a file named by the XXH64 of the source
+// seeded with everything the compiler's output depends on (the cache format
+// and opcode numbering, and the interpreter's words and arrays when the
+// script starts). Changing any of them changes the name, so stale entries
+// are never read; they are simply left behind.
+//
+// Compiling a line can define words and DIM arrays. The cache records those
+// effects with each line and replays them just before running it, exactly
+// where compilation would have made them. Should the interpreter not be in
+// the recorded state at that point, the rest of the script is compiled
+// from source as usual.
+
+namespace {
+
+constexpr char CACHE_MAGIC[8] = {'C', 'B', 'A', 'S', 'C', 'A', 'C', 'H'};
+
+// Bump whenever the compiler's output for the same source changes
+constexpr std::uint32_t CACHE_VERSION = 1;
+
+struct CachedArray {
+    std::string name;
+    bool integer = false;
+};
+
+// One compiled line and what compiling it did to the interpreter
+struct CachedLine {
+    std::uint32_t first_array = 0;  // the id of the first array it DIMs
+    std::vector<CachedArray> arrays;
+    std::uint32_t first_definition = 0;
+    std::vector<std::shared_ptr<const Code>> definitions;
+    std::shared_ptr<const Code> code;
+};
+
+// Names hash case-insensitively, as the dictionaries match them
+std::uint64_t hash_word(std::string_view name, Word word) {
+    ByteWriter key;
+    key.put(static_cast<std::uint64_t>(WordHash{}(name)));
+    key.put(word.op);
+    key.put(word.arg);
+    return XXHash64::hash(key.bytes());
+}
+
+bool keep(Instruction&) {
+    return true;
+}
+
+std::optional<std::vector<CachedLine>> read_cache(const std::filesystem::path& path, std::uint64_t key) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return std::nullopt;
+    }
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    const std::string bytes = std::move(contents).str();
+    ByteReader in(bytes.data(), bytes.size());
+
+    const auto magic = in.get<std::uint64_t>();
+    if (std::memcmp(&magic, CACHE_MAGIC, sizeof magic) != 0 || in.get<std::uint32_t>() != CACHE_VERSION ||
+        in.get<std::uint32_t>() != OP_COUNT || in.get<std::uint64_t>() != key) {
+        return std::nullopt;
+    }
+    std::vector<CachedLine> lines(in.get_count(20));
+    for (CachedLine& line : lines) {
+        line.first_array = in.get<std::uint32_t>();
+        line.arrays.resize(in.get_count(5));
+        for (CachedArray& array : line.arrays) {
+            array.name = in.get_string();
+            array.integer = in.get<std::uint8_t>() != 0;
+        }
+        line.first_definition = in.get<std::uint32_t>();
+        line.definitions.resize(in.get_count(12));
+        for (auto& definition : line.definitions) {
+            definition = get_code(in, keep);
+        }
+        line.code = get_code(in, keep);
+
+        const std::size_t arrays = line.first_array + line.arrays.size();
+        const std::size_t definitions = line.first_definition + line.definitions.size();
+        if (!line.code || !valid_code(*line.code, definitions, arrays)) {
+            return std::nullopt;
+        }
+        for (const auto& definition : line.definitions) {
+            if (!definition || !valid_code(*definition, definitions, arrays)) {
+                return std::nullopt;
+            }
+        }
+    }
+    if (!in.ok()) {
+        return std::nullopt;
+    }
+    return lines;
+}
+
+// Best effort: a cache that cannot be written only costs the next run a
+// compile. Written under a temporary name and renamed into place, so
+// concurrent writers (job workers) never leave a torn file.
+void write_cache(const std::filesystem::path& path, std::uint64_t key, const std::vector<CachedLine>& lines) {
+    ByteWriter out;
+    std::uint64_t magic;
+    std::memcpy(&magic, CACHE_MAGIC, sizeof magic);
+    out.put(magic);
+    out.put(CACHE_VERSION);
+    out.put(OP_COUNT);
+    out.put(key);
+    out.put(static_cast<std::uint32_t>(lines.size()));
+    for (const CachedLine& line : lines) {
+        out.put(line.first_array);
+        out.put(static_cast<std::uint32_t>(line.arrays.size()));
+        for (const CachedArray& array : line.arrays) {
+            out.put(std::string_view(array.name));
+            out.put(static_cast<std::uint8_t>(array.integer));
+        }
+        out.put(line.first_definition);
+        out.put(static_cast<std::uint32_t>(line.definitions.size()));
+        for (const auto& definition : line.definitions) {
+            put_code(out, *definition, keep);
+        }
+        put_code(out, *line.code, keep);
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    // Thread ids are only unique within a process, and processes can share
+    // a cache directory
+    auto temporary = path;
+    temporary += "." + std::to_string(getpid()) + "." +
+                 std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.write(out.bytes().data(), static_cast<std::streamsize>(out.bytes().size()))) {
+            file.close();
+            std::filesystem::remove(temporary, error);
+            return;
+        }
+    }
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::filesystem::remove(temporary, error);
+    }
+}
+
+} // namespace
+
+// Everything compiling a script depends on besides its source. Entries are
+// combined by addition, so the order the maps happen to iterate in does not
+// matter.
+std::uint64_t Interpreter::compile_environment() {
+    SharedDictionary::Pin base(reader_);
+    std::uint64_t words = 0;
+    for (const auto& [name, word] : base->words) {
+        words += hash_word(name, word);
+    }
+    std::uint64_t own = 0;
+    for (const auto& [name, word] : dictionary_) {
+        own += hash_word(name, word);
+    }
+    std::uint64_t arrays = 0;
+    for (const auto& [name, id] : array_ids_) {
+        arrays += hash_word(name, Word{Op::Dim, id}) ^ (arrays_[id].integer ? 1 : 0);
+    }
+    ByteWriter environment;
+    environment.put(CACHE_VERSION);
+    environment.put(OP_COUNT);
+    environment.put(words);
+    environment.put(own);
+    environment.put(arrays);
+    environment.put(static_cast<std::uint64_t>(arrays_.size()));
+    environment.put(static_cast<std::uint64_t>(definitions_.size()));
+    return XXHash64::hash(environment.bytes());
+}
+
+bool Interpreter::eval(std::string_view source, const std::filesystem::path& cache) {
+    const std::size_t errors = errors_;
+    const std::uint64_t key = XXHash64::hash(source, compile_environment());
+    char name[21];
+    std::snprintf(name, sizeof name, "%016llx.cbc", static_cast<unsigned long long>(key));
+    const std::filesystem::path path = cache / name;
+
+    if (auto lines = read_cache(path, key)) {
+        std::size_t n = 0;
+        bool replaying = true;
+        while (!source.empty()) {
+            std::string_view text = take_line(source);
+            const CachedLine* line = n < lines->size() ? &(*lines)[n] : nullptr;
+            ++n;
+            replaying = replaying && line && line->first_array == arrays_.size() &&
+                        line->first_definition == definitions_.size() &&
+                        std::none_of(line->arrays.begin(), line->arrays.end(),
+                                     [&](const CachedArray& array) { return array_ids_.contains(array.name); });
+            if (!replaying) {
+                run(compile(text), static_cast<std::uint32_t>(n));
+                continue;
+            }
+            for (const CachedArray& array : line->arrays) {
+                array_ids_.emplace(array.name, static_cast<std::uint32_t>(arrays_.size()));
+                arrays_.push_back({0, 0, array.integer});
+            }
+            for (const auto& definition : line->definitions) {
+                definitions_.push_back(definition);
+                dictionary_.insert_or_assign(definition->name,
+                                             Word{Op::ExecLocal, static_cast<std::uint32_t>(definitions_.size() - 1)});
+            }
+            run(*line->code, static_cast<std::uint32_t>(n));
+        }
+        return errors_ == errors;
+    }
+
+    // Not cached: compile as eval() does, recording each line's effects
+    std::vector<CachedLine> lines;
+    while (!source.empty()) {
+        CachedLine& line = lines.emplace_back();
+        line.first_array = static_cast<std::uint32_t>(arrays_.size());
+        line.first_definition = static_cast<std::uint32_t>(definitions_.size());
+        line.code = std::make_shared<Code>(compile(take_line(source)));
+        if (arrays_.size() > line.first_array) {
+            line.arrays.resize(arrays_.size() - line.first_array);
+            for (const auto& [array_name, id] : array_ids_) {
+                if (id >= line.first_array) {
+                    line.arrays[id - line.first_array] = {array_name, arrays_[id].integer};
+                }
+            }
+        }
+        line.definitions.assign(definitions_.begin() + line.first_definition, definitions_.end());
+        run(*line.code, static_cast<std::uint32_t>(lines.size()));
+    }
+    write_cache(path, key, lines);
+    return errors_ == errors;
+}
+
+} // namespace cbasic
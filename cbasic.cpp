@@ -0,0 +1,1734 @@
+#include "cbasic.hpp"
+#include "kernels.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+
+namespace cbasic {
+
+// A word: one or more non-whitespace code points, as a view into the line
+constexpr auto word_parser = cnomlite::take_codepoints1([](char32_t cp) { return !cnomlite::is_space(cp); },
+                                                        "non-whitespace character");
+
+// A line: words separated by (Unicode) whitespace
+constexpr auto split_parser = cnomlite::preceded(cnomlite::optional_p(cnomlite::unicode_space),
+                                                 cnomlite::sep_by(word_parser, cnomlite::unicode_space));
+
+// Split a constant word list during constant evaluation
+constexpr std::size_t count_words(std::string_view text) {
+    auto r = split_parser(text);
+    return std::get<cnomlite::ParseSuccess<std::vector<std::string_view>>>(r).value.size();
+}
+
+template <std::size_t N>
+constexpr std::array<std::string_view, N> split_words(std::string_view text) {
+    auto r = split_parser(text);
+    auto& words = std::get<cnomlite::ParseSuccess<std::vector<std::string_view>>>(r).value;
+    std::array<std::string_view, N> out{};
+    std::copy(words.begin(), words.end(), out.begin());
+    return out;
+}
+
+// Builtin aliases as "EXISTING ALIAS" pairs, parsed at compile time.
+// Preludes are not compiled at build time: Code calls builtins by their
+// number in a dictionary built at run time, so a library is precompiled
+// with SAVE-IMAGE and loaded with --image, which relocates those calls.
+constexpr std::string_view alias_source = R"(
+    PRINT P
+    ADD   +
+    SUB   -
+    MUL   *
+    ADD   A+
+    MUL   A*
+)";
+constexpr auto builtin_aliases = split_words<count_words(alias_source)>(alias_source);
+static_assert(builtin_aliases.size() % 2 == 0, "alias table must hold EXISTING ALIAS pairs");
+
+// -----------------------------
+// Compiler
+// -----------------------------
+// An array reference word: NAME(INDEX), NAME%(INDEX) or NAME()
+struct ArrayRef {
+    std::string_view name;
+    std::string_view index;  // empty: the index comes from the stack
+};
+
+constexpr auto array_ref_parser = cnomlite::sequence(
+    cnomlite::take_codepoints1([](char32_t cp) { return cnomlite::is_id_continue(cp) || cp == U'%'; }, "array name"),
+    cnomlite::preceded(cnomlite::char_p('('),
+                       cnomlite::terminated(cnomlite::optional_p(cnomlite::take_codepoints1([](char32_t cp) { return cp != U')'; }, "index")),
+                                            cnomlite::char_p(')'))));
+
+std::optional<ArrayRef> parse_array_ref(std::string_view word) {
+    auto r = array_ref_parser(word);
+    if (auto ps = std::get_if<cnomlite::ParseSuccess<std::pair<std::string_view, std::optional<std::string_view>>>>(&r);
+        ps && ps->remaining.empty()) {
+        return ArrayRef{ps->value.first, ps->value.second.value_or(std::string_view{})};
+    }
+    return std::nullopt;
+}
+
+// Compiles one line of words. Unknown words and malformed constructs compile
+// to Op::Error, which reports the problem when execution reaches it, so the
+// words before it still run as they always have.
+//
+// FOR loops are versioned to hoist array bounds checks: an access A(I)
+// indexed by a loop variable compiles to an unchecked load in the loop's
+// fast version, and one RangeCheck per array at loop entry verifies that
+// every index the loop will take is in bounds. If a check fails, a second,
+// fully checked copy of the body runs instead, so errors are reported at
+// the same iteration as without hoisting. A loop whose body may resize an
+// array (DIM, TO A, or a call of any word) is compiled checked only, as the
+// entry checks could go stale.
+class Compiler {
+public:
+    // Words resolve against `interpreter`'s dictionaries, which must be
+    // pinned, and DIM registers arrays with it
+    Compiler(const std::vector<std::string_view>& words, const cnomlite::LineIndex& source, Code& code,
+             Interpreter& interpreter, bool in_definition = false)
+        : words_(words), source_(source), code_(code), interpreter_(interpreter), arrays_(interpreter.arrays_),
+          array_ids_(interpreter.array_ids_), in_definition_(in_definition) {}
+
+    void compile() {
+        Block out;
+        out.reserve(words_.size());
+        while (pos_ < words_.size()) {
+            if (cnomlite::iequals(words_[pos_], "NEXT")) {
+                error(out, "NEXT without FOR", words_[pos_++]);
+            } else {
+                compile_word(out);
+            }
+        }
+        code_.instructions = std::move(out);
+    }
+
+private:
+    using Block = std::vector<Instruction>;
+
+    // Loops nested deeper than this are compiled with checked accesses only,
+    // bounding the code growth of versioning (each level doubles its body).
+    static constexpr std::size_t MAX_VERSIONED_DEPTH = 3;
+
+    struct Loop {
+        std::string_view var;
+        bool fast;                           // compiling the hoisted version
+        bool resizes = false;                // arrays may change inside the loop
+        std::vector<std::uint32_t> hoisted;  // arrays indexed by `var` without checks
+    };
+
+    static void emit(Block& out, Op op, std::uint32_t arg = 0, Value value = {}, std::uint16_t slot = 0) {
+        out.push_back({op, slot, arg, value});
+    }
+
+    void error(Block& out, const std::string& message, std::string_view at) {
+        auto loc = source_.locate(cnomlite::offset_in(source_.source(), at));
+        code_.strings.push_back("Error: " + message + " at " + std::to_string(loc.line) + ":" + std::to_string(loc.column));
+        emit(out, Op::Error, static_cast<std::uint32_t>(code_.strings.size() - 1));
+    }
+
+    // Distance of the loop declaring `var` from the innermost loop, or -1
+    int loop_slot(std::string_view var) const {
+        for (std::size_t k = loops_.size(); k-- > 0;) {
+            if (cnomlite::iequals(loops_[k].var, var)) {
+                return static_cast<int>(loops_.size() - 1 - k);
+            }
+        }
+        return -1;
+    }
+
+    void compile_word(Block& out) {
+        std::string_view word = words_[pos_++];
+        if (cnomlite::iequals(word, "FOR")) {
+            compile_for(out, word);
+        } else if (cnomlite::iequals(word, "DIM")) {
+            compile_dim(out, word);
+        } else if (cnomlite::iequals(word, "TO")) {
+            if (pos_ >= words_.size()) {
+                error(out, "TO needs an array element", word);
+            } else {
+                compile_array_access(out, words_[pos_++], true);
+            }
+        } else if (word == ":") {
+            compile_definition(out, word);
+        } else if (cnomlite::iequals(word, "SAVE-IMAGE")) {
+            if (pos_ >= words_.size()) {
+                error(out, "SAVE-IMAGE needs a file name", word);
+            } else {
+                code_.strings.emplace_back(words_[pos_++]);
+                emit(out, Op::SaveImage, static_cast<std::uint32_t>(code_.strings.size() - 1));
+            }
+        } else if (cnomlite::iequals(word, "PROFILE")) {
+            compile_profile(out, Op::Profile, word);
+        } else if (cnomlite::iequals(word, "SAMPLE")) {
+            compile_profile(out, Op::Sample, word);
+        } else if (cnomlite::iequals(word, "PERF{")) {
+            compile_timed(out, Op::PerfBegin, Op::PerfEnd, word);
+        } else if (cnomlite::iequals(word, "TIME{")) {
+            compile_timed(out, Op::TimeBegin, Op::TimeEnd, word);
+        } else if (cnomlite::iequals(word, "BENCH")) {
+            compile_bench(out, word);
+        } else if (cnomlite::iequals(word, "}PERF") || cnomlite::iequals(word, "}TIME")) {
+            error(out, std::string(word) + " without " + std::string(word.substr(1)) + "{", word);
+        } else if (word == "}") {
+            error(out, "} without BENCH n {", word);
+        } else if (is_pipeline_word(word)) {
+            compile_pipeline(out, word);
+        } else if (int slot = loop_slot(word); slot >= 0) {
+            emit(out, Op::LoopIndex, 0, {}, static_cast<std::uint16_t>(slot));
+        } else if (auto value = parse_number(word)) {
+            // Literals with an exponent ("1.5e0", "2E3") are float-stack
+            // literals, as in Forth; other numbers go on the data stack.
+            bool exponent = word.find_first_of("eE") != std::string_view::npos;
+            emit(out, exponent ? Op::FPush : Op::Push, 0, *value);
+        } else if (const Word* entry = lookup(word)) {
+            if (entry->op == Op::Call || entry->op == Op::CallLocal || entry->op == Op::Exec ||
+                entry->op == Op::ExecLocal) {
+                arrays_may_change();
+            }
+            emit(out, entry->op, entry->arg);
+        } else if (parse_array_ref(word)) {
+            compile_array_access(out, word, false);
+        } else if (auto array = array_ids_.find(word); array != array_ids_.end()) {
+            emit(out, Op::Push, 0, Value::array(array->second));
+        } else {
+            error(out, "Unknown command '" + std::string(word) + "'", word);
+        }
+    }
+
+    // The interpreter's own words shadow the shared ones
+    const Word* lookup(std::string_view word) const {
+        if (auto it = interpreter_.dictionary_.find(word); it != interpreter_.dictionary_.end()) {
+            return &it->second;
+        }
+        const Dictionary& base = interpreter_.reader_.version().words;
+        auto it = base.find(word);
+        return it != base.end() ? &it->second : nullptr;
+    }
+
+    // : NAME words ; compiles the words into a definition of NAME in the
+    // interpreter's own dictionary. NAME is defined as soon as it is
+    // compiled, so later words on the same line can use it; words inside
+    // are resolved now, so a later redefinition does not change it.
+    void compile_definition(Block& out, std::string_view colon) {
+        if (in_definition_ || !loops_.empty()) {
+            error(out, ": is only allowed outside definitions and loops", colon);
+            return;
+        }
+        auto end = std::find(words_.begin() + static_cast<std::ptrdiff_t>(pos_), words_.end(), std::string_view(";"));
+        if (pos_ >= words_.size() || end == words_.begin() + static_cast<std::ptrdiff_t>(pos_)) {
+            error(out, ": needs a name", colon);
+            return;
+        }
+        if (end == words_.end()) {
+            error(out, "Missing ; after : " + std::string(words_[pos_]), colon);
+            pos_ = words_.size();
+            return;
+        }
+        std::string_view name = words_[pos_++];
+        std::vector<std::string_view> body(words_.begin() + static_cast<std::ptrdiff_t>(pos_), end);
+        pos_ = static_cast<std::size_t>(end - words_.begin()) + 1;
+        auto code = std::make_shared<Code>();
+        code->name = name;
+        Compiler(body, source_, *code, interpreter_, true).compile();
+        interpreter_.definitions_.push_back(std::move(code));
+        interpreter_.dictionary_.insert_or_assign(
+            std::string(name), Word{Op::ExecLocal, static_cast<std::uint32_t>(interpreter_.definitions_.size() - 1)});
+    }
+
+    // PROFILE or SAMPLE, then ON, OFF, RESET, REPORT or FOLDED file. The
+    // command goes in `slot` and the file name, empty but for FOLDED, in
+    // code_.strings.
+    void compile_profile(Block& out, Op op, std::string_view word) {
+        const std::string name = op == Op::Profile ? "PROFILE" : "SAMPLE";
+        auto command = pos_ < words_.size() ? lookup_fn(PROFILE_COMMANDS, words_[pos_++]) : std::nullopt;
+        if (!command) {
+            error(out, name + " needs ON, OFF, RESET, REPORT or FOLDED file", word);
+            return;
+        }
+        std::string_view path;
+        if (*command == ProfileCommand::Folded) {
+            if (pos_ >= words_.size()) {
+                error(out, name + " FOLDED needs a file name", word);
+                return;
+            }
+            path = words_[pos_++];
+        }
+        code_.strings.emplace_back(path);
+        emit(out, op, static_cast<std::uint32_t>(code_.strings.size() - 1), {}, static_cast<std::uint16_t>(*command));
+    }
+
+    // Compile the words up to `close` into `body` and step past it. False if
+    // `close` is missing from the line or definition, or comes after the
+    // NEXT of an enclosing loop.
+    bool compile_region(Block& body, std::string_view close) {
+        while (pos_ < words_.size() && !cnomlite::iequals(words_[pos_], close) &&
+               !cnomlite::iequals(words_[pos_], "NEXT")) {
+            compile_word(body);
+        }
+        if (pos_ >= words_.size() || !cnomlite::iequals(words_[pos_], close)) {
+            return false;
+        }
+        ++pos_;
+        return true;
+    }
+
+    // Names a region for reports: the source of words_[first, last),
+    // shortened, after its definition's name
+    std::uint32_t region_label(std::size_t first, std::size_t last) {
+        static constexpr std::size_t MAX_LABEL = 40;
+        std::string label = code_.name.empty() ? "" : code_.name + ": ";
+        if (first == last) {
+            label += "(empty)";
+        } else {
+            const char* begin = words_[first].data();
+            const char* end = words_[last - 1].data() + words_[last - 1].size();
+            std::string_view words(begin, static_cast<std::size_t>(end - begin));
+            label += words.size() > MAX_LABEL ? std::string(words.substr(0, MAX_LABEL)) + "..." : std::string(words);
+        }
+        code_.strings.push_back(std::move(label));
+        return static_cast<std::uint32_t>(code_.strings.size() - 1);
+    }
+
+    // PERF{ words }PERF counts the hardware events of the words between,
+    // and TIME{ words }TIME ( -- ns ) times them
+    void compile_timed(Block& out, Op begin, Op end, std::string_view open) {
+        const std::string_view close = begin == Op::PerfBegin ? "}PERF" : "}TIME";
+        const std::size_t first = pos_;
+        Block body;
+        if (!compile_region(body, close)) {
+            error(out, std::string(open) + " without " + std::string(close), open);
+            return;
+        }
+        const std::uint32_t label = begin == Op::PerfBegin ? region_label(first, pos_ - 1) : 0;
+        emit(out, begin, label);
+        out.insert(out.end(), body.begin(), body.end());
+        emit(out, end, label);
+    }
+
+    // BENCH n { words } runs the words n times after a warm-up, and reports
+    // how long a run took. The count is a literal, as DIM's size is.
+    void compile_bench(Block& out, std::string_view bench) {
+        static constexpr std::int64_t MAX_RUNS = 10'000'000;
+        auto n = pos_ < words_.size() ? parse_number(words_[pos_++]) : std::nullopt;
+        if (pos_ >= words_.size() || words_[pos_] != "{") {
+            error(out, "BENCH n needs a { block }", bench);
+            return;
+        }
+        const std::size_t first = ++pos_;
+        Block body;
+        if (!compile_region(body, "}")) {
+            error(out, "BENCH { without }", bench);
+            return;
+        }
+        if (!n || !n->is_int() || n->as_int() < 1 || n->as_int() > MAX_RUNS) {
+            error(out, "BENCH needs a count from 1 to " + std::to_string(MAX_RUNS), bench);
+            return;
+        }
+        const std::size_t base = out.size();
+        emit(out, Op::BenchBegin, region_label(first, pos_ - 1), *n);
+        out.insert(out.end(), body.begin(), body.end());
+        emit(out, Op::BenchEnd, jump_offset(out.size(), base + 1));
+    }
+
+    static bool is_pipeline_word(std::string_view word) {
+        return cnomlite::iequals(word, "MAP") || cnomlite::iequals(word, "ZIP") ||
+               cnomlite::iequals(word, "FILTER") || cnomlite::iequals(word, "REDUCE");
+    }
+
+    // MAP f, ZIP f, FILTER cmp and REDUCE f: the function word that follows is
+    // resolved here and compiled into the instruction's `arg`
+    void compile_pipeline(Block& out, std::string_view word) {
+        std::string_view name = pos_ < words_.size() ? words_[pos_++] : std::string_view{};
+        auto emit_fn = [&](Op op, auto fn) {
+            emit(out, op, static_cast<std::uint32_t>(fn));
+        };
+        if (cnomlite::iequals(word, "MAP")) {
+            auto fn = lookup_fn(MAP_FNS, name);
+            fn ? emit_fn(Op::Map, *fn) : error(out, "MAP needs ABS, NEGATE, SQRT or SQUARE", word);
+        } else if (cnomlite::iequals(word, "ZIP")) {
+            auto fn = lookup_fn(ZIP_FNS, name);
+            fn ? emit_fn(Op::Zip, *fn) : error(out, "ZIP needs +, -, *, MAX or MIN", word);
+        } else if (cnomlite::iequals(word, "FILTER")) {
+            auto cmp = lookup_fn(COMPARES, name);
+            cmp ? emit_fn(Op::Filter, *cmp) : error(out, "FILTER needs <, <=, >, >=, = or <>", word);
+        } else {
+            auto fn = lookup_fn(ZIP_FNS, name);
+            fn && *fn != ZipFn::Sub ? emit_fn(Op::Reduce, *fn) : error(out, "REDUCE needs +, *, MAX or MIN", word);
+        }
+    }
+
+    // DIM NAME(n) or DIM NAME() ( n -- ): NAME gets indices 0..n, as in BASIC
+    void compile_dim(Block& out, std::string_view dim) {
+        auto ref = pos_ < words_.size() ? parse_array_ref(words_[pos_]) : std::nullopt;
+        if (!ref) {
+            error(out, "DIM needs NAME(size)", dim);
+            return;
+        }
+        std::string_view word = words_[pos_++];
+        std::int64_t size = -1;
+        if (!ref->index.empty()) {
+            auto n = parse_number(ref->index);
+            if (!n || !n->is_int() || n->as_int() < 0) {
+                error(out, "DIM size must be a non-negative integer", word);
+                return;
+            }
+            size = n->as_int() + 1;
+        }
+        auto [it, inserted] = array_ids_.try_emplace(std::string(ref->name), static_cast<std::uint32_t>(arrays_.size()));
+        if (inserted) {
+            arrays_.push_back({0, 0, ref->name.ends_with('%')});
+        }
+        arrays_may_change();
+        emit(out, Op::Dim, it->second, Value::integer(size));
+    }
+
+    // NAME(index) loads; TO NAME(index) stores; TO NAME assigns a whole array
+    void compile_array_access(Block& out, std::string_view word, bool store) {
+        if (auto whole = array_ids_.find(word); store && whole != array_ids_.end()) {
+            arrays_may_change();
+            emit(out, Op::AAssign, whole->second);
+            return;
+        }
+        auto ref = parse_array_ref(word);
+        auto id = ref ? array_ids_.find(ref->name) : array_ids_.end();
+        if (id == array_ids_.end()) {
+            error(out, ref ? "Unknown array '" + std::string(ref->name) + "'" : "TO needs an array element", word);
+            return;
+        }
+        const std::uint32_t array = id->second;
+        if (ref->index.empty()) {
+            emit(out, store ? Op::AStore : Op::ALoad, array);
+        } else if (int slot = loop_slot(ref->index); slot >= 0) {
+            Loop& loop = loops_[loops_.size() - 1 - static_cast<std::size_t>(slot)];
+            if (loop.fast) {
+                if (std::find(loop.hoisted.begin(), loop.hoisted.end(), array) == loop.hoisted.end()) {
+                    loop.hoisted.push_back(array);
+                }
+                emit(out, store ? Op::AStoreLoop : Op::ALoadLoop, array, {}, static_cast<std::uint16_t>(slot));
+            } else {
+                emit(out, Op::LoopIndex, 0, {}, static_cast<std::uint16_t>(slot));
+                emit(out, store ? Op::AStore : Op::ALoad, array);
+            }
+        } else if (auto n = parse_number(ref->index); n && n->is_int()) {
+            emit(out, Op::Push, 0, *n);
+            emit(out, store ? Op::AStore : Op::ALoad, array);
+        } else {
+            error(out, "Array index must be a number, a loop variable or empty", word);
+        }
+    }
+
+    // Every enclosing loop's body may resize an array: a DIM, a whole-array
+    // TO, or a word call, whose body the compiler does not see
+    void arrays_may_change() {
+        for (auto& loop : loops_) {
+            loop.resizes = true;
+        }
+    }
+
+    // A FOR bound: a numeric literal or an enclosing loop's variable
+    bool compile_bound(Block& out, std::string_view word) {
+        if (int slot = loop_slot(word); slot >= 0) {
+            emit(out, Op::LoopIndex, 0, {}, static_cast<std::uint16_t>(slot));
+            return true;
+        }
+        if (auto n = parse_number(word); n && n->is_int()) {
+            emit(out, Op::Push, 0, *n);
+            return true;
+        }
+        return false;
+    }
+
+    // FOR V = a TO b [STEP s] ... NEXT [V], or FOR V ... NEXT [V] with
+    // ( start limit ) taken from the stack
+    void compile_for(Block& out, std::string_view for_word) {
+        if (pos_ >= words_.size()) {
+            error(out, "FOR needs a loop variable", for_word);
+            return;
+        }
+        std::string_view var = words_[pos_++];
+        Block header;
+        auto next_is = [&](std::string_view keyword) {
+            return pos_ < words_.size() && cnomlite::iequals(words_[pos_], keyword);
+        };
+        if (next_is("=")) {
+            ++pos_;
+            bool ok = pos_ < words_.size() && compile_bound(header, words_[pos_++]);
+            ok = ok && next_is("TO");
+            ++pos_;
+            ok = ok && pos_ < words_.size() && compile_bound(header, words_[pos_++]);
+            if (ok && next_is("STEP")) {
+                ++pos_;
+                auto n = pos_ < words_.size() ? parse_number(words_[pos_++]) : std::nullopt;
+                ok = n && n->is_int() && n->as_int() != 0;
+                emit(header, Op::Push, 0, n ? *n : Value{});
+            } else {
+                emit(header, Op::Push, 0, Value::integer(1));
+            }
+            if (!ok) {
+                error(out, "Expected FOR " + std::string(var) + " = start TO limit [STEP n]", for_word);
+                return;
+            }
+        } else {
+            emit(header, Op::Push, 0, Value::integer(1));
+        }
+
+        const std::size_t body_start = pos_;
+        const bool versioned = loops_.size() < MAX_VERSIONED_DEPTH;
+        Block fast;
+        Loop loop = compile_body(fast, var, versioned);
+        if (pos_ > words_.size()) {
+            error(out, "FOR without NEXT", for_word);
+            return;
+        }
+        const std::size_t body_end = pos_;
+
+        Block checked;
+        const bool hoist = versioned && !loop.resizes && !loop.hoisted.empty();
+        if (versioned && !hoist && !loop.hoisted.empty()) {
+            // An array may be resized inside the loop: the hoisted checks could go stale
+            pos_ = body_start;
+            fast.clear();
+            compile_body(fast, var, false);
+        } else if (hoist) {
+            pos_ = body_start;
+            compile_body(checked, var, false);
+        }
+        pos_ = body_end;
+
+        // Layout (offsets relative to ForBegin):
+        //   ForBegin -> end; RangeCheck... -> checked; fast; Next -> fast;
+        //   [Jump -> end; checked; Next -> checked]; end:
+        out.insert(out.end(), header.begin(), header.end());
+        const std::size_t base = out.size();
+        const std::size_t checks = hoist ? loop.hoisted.size() : 0;
+        const std::size_t fast_start = base + 1 + checks;
+        const std::size_t fast_next = fast_start + fast.size();
+        const std::size_t checked_start = fast_next + 2;
+        const std::size_t end = hoist ? checked_start + checked.size() + 1 : fast_next + 1;
+
+        emit(out, Op::ForBegin, jump_offset(base, end));
+        for (std::uint32_t array : (hoist ? loop.hoisted : std::vector<std::uint32_t>{})) {
+            emit(out, Op::RangeCheck, jump_offset(out.size(), checked_start), Value::integer(array));
+        }
+        out.insert(out.end(), fast.begin(), fast.end());
+        emit(out, Op::Next, jump_offset(fast_next, fast_start));
+        if (hoist) {
+            emit(out, Op::Jump, jump_offset(fast_next + 1, end));
+            out.insert(out.end(), checked.begin(), checked.end());
+            emit(out, Op::Next, jump_offset(out.size(), checked_start));
+        }
+    }
+
+    // Compile a loop body up to and including its NEXT [var]. On a missing
+    // NEXT, pos_ is left past the end of the words.
+    Loop compile_body(Block& out, std::string_view var, bool fast) {
+        loops_.push_back(Loop{var, fast, false, {}});
+        bool closed = false;
+        while (pos_ < words_.size()) {
+            if (cnomlite::iequals(words_[pos_], "NEXT")) {
+                ++pos_;
+                if (pos_ < words_.size() && cnomlite::iequals(words_[pos_], var)) {
+                    ++pos_;
+                }
+                closed = true;
+                break;
+            }
+            compile_word(out);
+        }
+        Loop loop = std::move(loops_.back());
+        loops_.pop_back();
+        if (loop.resizes) {
+            arrays_may_change();
+        }
+        if (!closed) {
+            pos_ = words_.size() + 1;
+        }
+        return loop;
+    }
+
+    const std::vector<std::string_view>& words_;
+    const cnomlite::LineIndex& source_;
+    Code& code_;
+    Interpreter& interpreter_;
+    std::vector<Array>& arrays_;
+    ArrayIds& array_ids_;
+    bool in_definition_;
+    std::size_t pos_ = 0;
+    std::vector<Loop> loops_;
+};
+
+// -----------------------------
+// Interpreter and VM
+// -----------------------------
+// NOW counts from process start rather than steady_clock's epoch (boot, on
+// Linux), so it stays a 48-bit integer for the first 39 hours of a run
+// rather than of the machine's uptime
+static const std::chrono::steady_clock::time_point clock_epoch = std::chrono::steady_clock::now();
+
+std::shared_ptr<SharedDictionary> standard_dictionary() {
+    static const std::shared_ptr<SharedDictionary> standard = [] {
+        auto dictionary = std::make_shared<SharedDictionary>();
+        dictionary->publish([](DictionaryVersion& v) {
+            auto command = [&](std::string_view name, Builtin builtin) {
+                v.builtins.push_back(std::move(builtin));
+                v.words.insert_or_assign(std::string(name), Word{Op::Call, static_cast<std::uint32_t>(v.builtins.size() - 1)});
+            };
+            auto opcode = [&](std::string_view name, Op op) {
+                v.words.insert_or_assign(std::string(name), Word{op, 0});
+            };
+            command("PRINT", &Interpreter::print_stack);
+            opcode("ADD", Op::Add);
+            opcode("SUB", Op::Sub);
+            opcode("MUL", Op::Mul);
+            opcode("F+", Op::FAdd);
+            opcode("F-", Op::FSub);
+            opcode("F*", Op::FMul);
+            opcode("F/", Op::FDiv);
+            opcode("F.", Op::FPrint);
+            opcode("FDUP", Op::FDup);
+            opcode("FDROP", Op::FDrop);
+            opcode("FSWAP", Op::FSwap);
+            opcode(">F", Op::ToFloat);
+            opcode("F>", Op::FromFloat);
+            opcode("HERE", Op::Here);
+            opcode("ALLOT", Op::Allot);
+            opcode("CELLS", Op::Cells);
+            opcode("@", Op::Fetch);
+            opcode("!", Op::Store);
+            opcode("C@", Op::CFetch);
+            opcode("C!", Op::CStore);
+            opcode("ASUM", Op::ASum);
+            opcode("AMAX", Op::AMax);
+            opcode("ADOT", Op::ADot);
+            opcode("AFILL", Op::AFill);
+            opcode("AIOTA", Op::AIota);
+            opcode("NOW", Op::Now);
+            for (std::size_t i = 0; i < builtin_aliases.size(); i += 2) {
+                v.words.insert_or_assign(std::string(builtin_aliases[i + 1]), v.words.at(std::string(builtin_aliases[i])));
+            }
+        });
+        return dictionary;
+    }();
+    return standard;
+}
+
+Interpreter::Interpreter(std::ostream& out, std::shared_ptr<SharedDictionary> base)
+    : out_(out), base_(std::move(base)), reader_(*base_) {}
+
+void Interpreter::reset() {
+    stop_profiling();
+    data_stack_.clear();
+    float_stack_.clear();
+    loop_stack_.clear();
+    perf_marks_.clear();
+    time_marks_.clear();
+    benches_.clear();
+    exprs_.clear();
+    temporaries_.clear();
+    arrays_.clear();
+    array_ids_.clear();
+    std::erase_if(dictionary_, [](const auto& entry) { return entry.second.op == Op::ExecLocal; });
+    definitions_.clear();
+    pending_.clear();
+    heap_.clear();
+    scratch_.clear();
+    errors_ = 0;
+}
+
+std::shared_ptr<const InterpreterSnapshot> Interpreter::snapshot() const {
+    auto snapshot = std::make_shared<InterpreterSnapshot>(heap_);
+    snapshot->base = base_;
+    snapshot->data_stack = data_stack_;
+    snapshot->float_stack = float_stack_;
+    snapshot->dictionary = dictionary_;
+    snapshot->builtins = builtins_;
+    snapshot->definitions = definitions_;
+    snapshot->pending = pending_;
+    snapshot->arrays = arrays_;
+    snapshot->array_ids = array_ids_;
+    snapshot->color = out_.color();
+    return snapshot;
+}
+
+void Interpreter::restore(const InterpreterSnapshot& snapshot) {
+    if (snapshot.base != base_) {
+        report("Error: Cannot restore a snapshot taken with another base dictionary.");
+        return;
+    }
+    stop_profiling();
+    data_stack_ = snapshot.data_stack;
+    float_stack_ = snapshot.float_stack;
+    loop_stack_.clear();
+    exprs_.clear();
+    temporaries_.clear();
+    arrays_ = snapshot.arrays;
+    array_ids_ = snapshot.array_ids;
+    dictionary_ = snapshot.dictionary;
+    builtins_ = snapshot.builtins;
+    definitions_ = snapshot.definitions;
+    pending_ = snapshot.pending;
+    heap_.restore(snapshot.heap);
+    scratch_.clear();
+    out_.set_color(snapshot.color);
+    errors_ = 0;
+}
+
+std::unique_ptr<Interpreter> Interpreter::fork(std::ostream& out) const {
+    auto child = std::make_unique<Interpreter>(out, base_);
+    child->restore(*snapshot());
+    return child;
+}
+
+// Words are matched case-insensitively by the dictionary itself, so one
+// entry serves "PRINT", "print" and "Print" alike.
+void Interpreter::register_command(std::string_view name, Builtin command) {
+    builtins_.push_back(std::move(command));
+    dictionary_.insert_or_assign(std::string(name), Word{Op::CallLocal, static_cast<std::uint32_t>(builtins_.size() - 1)});
+}
+
+// Words implemented directly by a VM opcode
+void Interpreter::register_opcode(std::string_view name, Op op) {
+    dictionary_.insert_or_assign(std::string(name), Word{op, 0});
+}
+
+void Interpreter::alias(std::string_view existing, std::string_view alias_name) {
+    SharedDictionary::Pin base(reader_);
+    if (auto it = dictionary_.find(existing); it != dictionary_.end()) {
+        dictionary_.insert_or_assign(std::string(alias_name), it->second);
+    } else if (auto shared = base->words.find(existing); shared != base->words.end()) {
+        dictionary_.insert_or_assign(std::string(alias_name), shared->second);
+    } else {
+        report("Error: Unknown command '" + std::string(existing) + "'");
+    }
+}
+
+// Code that refers to this interpreter's own words or arrays by number
+static bool uses_local_state(const Code& code) {
+    return std::any_of(code.instructions.begin(), code.instructions.end(), [](const Instruction& in) {
+        switch (in.op) {
+            case Op::CallLocal:
+            case Op::ExecLocal:
+            case Op::RangeCheck:
+            case Op::Dim:
+            case Op::ALoad:
+            case Op::AStore:
+            case Op::ALoadLoop:
+            case Op::AStoreLoop:
+            case Op::AAssign:
+                return true;
+            case Op::Push:
+                return in.value.is_reference();
+            default:
+                return false;
+        }
+    });
+}
+
+bool Interpreter::share(std::string_view name) {
+    auto it = dictionary_.find(name);
+    if (it == dictionary_.end()) {
+        report("Error: Unknown command '" + std::string(name) + "'");
+        return false;
+    }
+    const Word word = it->second;
+    if (word.op == Op::CallLocal) {
+        base_->register_command(name, builtins_[word.arg]);
+    } else if (word.op == Op::ExecLocal) {
+        if (uses_local_state(definition(word.arg))) {
+            report("Error: " + std::string(name) + " uses this interpreter's own words or arrays and cannot be shared.");
+            return false;
+        }
+        base_->define(name, definitions_[word.arg]);
+    } else {
+        // Opcodes, and aliases of shared words, mean the same everywhere
+        base_->publish([&](DictionaryVersion& v) { v.words.insert_or_assign(std::string(name), word); });
+    }
+    dictionary_.erase(it);
+    profiler_.forget_words();
+    return true;
+}
+
+// Helper: Print the stack contents
+void Interpreter::print_stack() {
+    out_.paint<Color::Green>("Stack: ");
+    for (const auto& item : data_stack_) {
+        out_ << item << ' ';
+    }
+    out_ << '\n';
+    if (!float_stack_.empty()) {
+        out_.paint<Color::Green>("Float stack: ");
+        for (double item : float_stack_) {
+            out_ << item << ' ';
+        }
+        out_ << '\n';
+    }
+}
+
+// Basic words for CBASIC
+void Interpreter::add() {
+    if (data_stack_.size() < 2) {
+        report("Error: ADD requires at least two values on the stack.");
+        return;
+    }
+    Value b = data_stack_.back(); data_stack_.pop_back();
+    Value a = data_stack_.back(); data_stack_.pop_back();
+    if (both_int(a, b)) {
+        data_stack_.push_back(Value::integer(a.as_int() + b.as_int()));
+    } else if (a.is_reference() || b.is_reference()) {
+        array_zip("ADD", ZipFn::Add, a, b);
+    } else {
+        data_stack_.push_back(Value::real(a.to_double() + b.to_double()));
+    }
+}
+
+void Interpreter::subtract() {
+    if (data_stack_.size() < 2) {
+        report("Error: SUBTRACT requires at least two values on the stack.");
+        return;
+    }
+    Value b = data_stack_.back(); data_stack_.pop_back();
+    Value a = data_stack_.back(); data_stack_.pop_back();
+    if (both_int(a, b)) {
+        data_stack_.push_back(Value::integer(a.as_int() - b.as_int()));
+    } else if (a.is_reference() || b.is_reference()) {
+        array_zip("SUB", ZipFn::Sub, a, b);
+    } else {
+        data_stack_.push_back(Value::real(a.to_double() - b.to_double()));
+    }
+}
+
+void Interpreter::multiply() {
+    if (data_stack_.size() < 2) {
+        report("Error: MUL requires at least two values on the stack.");
+        return;
+    }
+    Value b = data_stack_.back(); data_stack_.pop_back();
+    Value a = data_stack_.back(); data_stack_.pop_back();
+    if (both_int(a, b)) {
+        // A product of 48-bit integers can overflow int64; those become doubles
+        double p = static_cast<double>(a.as_int()) * static_cast<double>(b.as_int());
+        data_stack_.push_back(std::abs(p) < 0x1p62 ? Value::integer(a.as_int() * b.as_int()) : Value::real(p));
+    } else if (a.is_reference() || b.is_reference()) {
+        array_zip("MUL", ZipFn::Mul, a, b);
+    } else {
+        data_stack_.push_back(Value::real(a.to_double() * b.to_double()));
+    }
+}
+
+void Interpreter::push(Value value) {
+    data_stack_.push_back(value);
+}
+
+// Float words. Every operand is a double, so no type is ever tested.
+bool Interpreter::require_floats(std::size_t count, const char* word) {
+    if (float_stack_.size() < count) {
+        report(std::string("Error: ") + word + " requires at least " + std::to_string(count) +
+               (count == 1 ? " value" : " values") + " on the float stack.");
+        return false;
+    }
+    return true;
+}
+
+template <typename F>
+void Interpreter::float_binary(const char* word, F f) {
+    if (require_floats(2, word)) {
+        double b = float_stack_.back(); float_stack_.pop_back();
+        float_stack_.back() = f(float_stack_.back(), b);
+    }
+}
+
+// Memory words
+bool Interpreter::require_values(std::size_t count, const char* word) {
+    if (data_stack_.size() < count) {
+        report(std::string("Error: ") + word + " requires at least " + std::to_string(count) +
+               (count == 1 ? " value" : " values") + " on the stack.");
+        return false;
+    }
+    return true;
+}
+
+void Interpreter::report(std::string_view message) {
+    ++errors_;
+    out_.paint<Color::Red>(message) << '\n';
+}
+
+// Pop an address and check that [addr, addr + width) is allotted memory
+bool Interpreter::pop_address(std::uint64_t width, const char* word, std::uint64_t& addr) {
+    Value v = data_stack_.back(); data_stack_.pop_back();
+    addr = static_cast<std::uint64_t>(v.as_int());
+    if (!v.is_int() || v.as_int() < 0 || !heap_.in_bounds(addr, width)) {
+        report(std::string("Error: ") + word + " address " + to_string(v) +
+               " is outside allotted memory (HERE = " + std::to_string(heap_.here()) + ").");
+        return false;
+    }
+    return true;
+}
+
+// Array element access
+bool Interpreter::check_index(const Array& array, std::int64_t index, std::uint32_t id) {
+    if (index < 0 || static_cast<std::uint64_t>(index) >= array.length) {
+        std::string name = "array";
+        for (const auto& [key, value] : array_ids_) {
+            if (value == id) name = key;
+        }
+        report("Error: index " + std::to_string(index) + " is out of range for " + name + "(0.." +
+               std::to_string(static_cast<std::int64_t>(array.length) - 1) + ").");
+        return false;
+    }
+    return true;
+}
+
+Heap& Interpreter::arena_of(const Array& array) {
+    return array.temporary ? scratch_ : heap_;
+}
+
+Value Interpreter::load_element(const Array& array, std::uint64_t index) {
+    std::uint64_t addr = array.offset + index * CELL;
+    const Heap& arena = arena_of(array);
+    return array.integer ? Value::integer(arena.load<std::int64_t>(addr)) : Value::real(arena.load<double>(addr));
+}
+
+void Interpreter::store_element(const Array& array, std::uint64_t index, Value v) {
+    std::uint64_t addr = array.offset + index * CELL;
+    Heap& arena = arena_of(array);
+    if (array.integer) {
+        arena.store(addr, v.to_int());
+    } else {
+        arena.store(addr, v.to_double());
+    }
+}
+
+template <typename T>
+T* Interpreter::elements(const Array& array) {
+    return reinterpret_cast<T*>(arena_of(array).data() + array.offset);
+}
+
+// Allocate `length` zeroed elements at HERE (cell aligned)
+void Interpreter::dim_array(Array& array, std::int64_t length) {
+    std::uint64_t start = (heap_.here() + CELL - 1) & ~(CELL - 1);
+    if (length < 0 || !heap_.allot(static_cast<std::int64_t>(start - heap_.here())) ||
+        !heap_.allot(length * static_cast<std::int64_t>(CELL))) {
+        report("Error: DIM of " + std::to_string(length) + " elements exceeds the heap.");
+        return;
+    }
+    std::memset(heap_.data() + start, 0, static_cast<std::size_t>(length) * CELL);
+    array = {start, static_cast<std::uint64_t>(length), array.integer};
+}
+
+// -----------------------------
+// Array words
+// -----------------------------
+// APL-style words over whole arrays. Each runs one SIMD kernel (see
+// kernels.hpp) over all elements instead of dispatching per element.
+// Results are temporaries in the scratch arena; they live until the end of
+// the line, or longer while a reference to one is left on the stack.
+std::optional<std::uint32_t> Interpreter::new_temporary(std::uint64_t length, bool integer) {
+    std::uint64_t start = (scratch_.here() + 63) & ~std::uint64_t{63};
+    if (!scratch_.allot(static_cast<std::int64_t>(start - scratch_.here())) ||
+        !scratch_.allot(static_cast<std::int64_t>(length * CELL))) {
+        report("Error: array temporaries exceed the scratch arena.");
+        return std::nullopt;
+    }
+    auto id = static_cast<std::uint32_t>(arrays_.size());
+    arrays_.push_back({start, length, integer, true});
+    temporaries_.push_back(id);
+    return id;
+}
+
+// Drop all temporaries and expression nodes once none is referenced from
+// the data stack (an expression may read temporaries)
+void Interpreter::release_temporaries() {
+    if (temporaries_.empty() && exprs_.size() == 0) {
+        return;
+    }
+    for (Value v : data_stack_) {
+        if ((v.is_array() && arrays_[v.as_array()].temporary) || v.is_expr()) {
+            return;
+        }
+    }
+    exprs_.clear();
+    // Temporaries are created after every DIM array compiled so far, but a
+    // line can DIM while older temporaries are alive, so free slots in place.
+    for (std::uint32_t id : temporaries_) {
+        arrays_[id] = {};
+    }
+    while (!arrays_.empty() && arrays_.back().length == 0 && arrays_.back().offset == 0 &&
+           std::find(temporaries_.begin(), temporaries_.end(), arrays_.size() - 1) != temporaries_.end()) {
+        arrays_.pop_back();
+    }
+    temporaries_.clear();
+    scratch_.allot(-static_cast<std::int64_t>(scratch_.here()));
+}
+
+bool Interpreter::pop_array(const char* word, std::uint32_t& id) {
+    Value v = data_stack_.back();
+    data_stack_.pop_back();
+    if (!v.is_array() || v.as_array() >= arrays_.size()) {
+        report(std::string("Error: ") + word + " expects an array, found " + to_string(v) + ".");
+        return false;
+    }
+    id = v.as_array();
+    return true;
+}
+
+// -----------------------------
+// Array pipelines
+// -----------------------------
+// Arithmetic on arrays, MAP, ZIP and FILTER push references to nodes of a
+// lazy expression graph (see pipeline.hpp); REDUCE, ASUM, AMAX, ADOT and TO
+// evaluate one in a single fused pass. Like temporaries, nodes live until
+// the end of the line or while a reference is left on the stack.
+
+// The node for an operand: arrays become Source nodes and numbers Scalar ones
+std::optional<std::uint32_t> Interpreter::expr_node(const char* word, Value v) {
+    if (v.is_expr() && v.as_expr() < exprs_.size()) {
+        return v.as_expr();
+    }
+    if (v.is_array() && v.as_array() < arrays_.size()) {
+        const Array& a = arrays_[v.as_array()];
+        return exprs_.add({ExprNode::Kind::Source, 0, a.integer, false, v.as_array(), 0, a.length, {}});
+    }
+    if (!v.is_reference()) {
+        return exprs_.add({ExprNode::Kind::Scalar, 0, v.is_int(), false, 0, 0, 0, v});
+    }
+    report(std::string("Error: ") + word + " expects an array, found " + to_string(v) + ".");
+    return std::nullopt;
+}
+
+// Pop an array or expression
+bool Interpreter::pop_stream(const char* word, std::uint32_t& node) {
+    Value v = data_stack_.back();
+    data_stack_.pop_back();
+    if (!v.is_array() && !v.is_expr()) {
+        report(std::string("Error: ") + word + " expects an array, found " + to_string(v) + ".");
+        return false;
+    }
+    auto id = expr_node(word, v);
+    node = id.value_or(0);
+    return id.has_value();
+}
+
+bool Interpreter::array_zip(const char* word, ZipFn fn, Value a, Value b) {
+    auto lhs = expr_node(word, a);
+    auto rhs = lhs ? expr_node(word, b) : std::nullopt;
+    if (!rhs) {
+        return false;
+    }
+    const ExprNode x = exprs_[*lhs];
+    const ExprNode y = exprs_[*rhs];
+    const bool x_stream = x.kind != ExprNode::Kind::Scalar;
+    const bool y_stream = y.kind != ExprNode::Kind::Scalar;
+    const char* problem = !x_stream && !y_stream          ? " needs an array."
+                        : !x_stream || !y_stream          ? nullptr
+                        : x.filtered || y.filtered        ? " cannot combine a FILTERed array with another array."
+                        : x.length != y.length            ? " needs arrays of equal length."
+                                                          : nullptr;
+    if (problem) {
+        report(std::string("Error: ") + word + problem);
+        return false;
+    }
+    data_stack_.push_back(Value::expr(exprs_.add({ExprNode::Kind::Zip, static_cast<std::uint8_t>(fn), x.integer && y.integer,
+                                                x.filtered || y.filtered, *lhs, *rhs, std::max(x.length, y.length), {}})));
+    return true;
+}
+
+// ZIP f: ( a b -- e )
+void Interpreter::zip_word(ZipFn fn) {
+    if (require_values(2, "ZIP")) {
+        Value b = data_stack_.back(); data_stack_.pop_back();
+        Value a = data_stack_.back(); data_stack_.pop_back();
+        array_zip("ZIP", fn, a, b);
+    }
+}
+
+// MAP f: ( a -- e )
+void Interpreter::map_word(MapFn fn) {
+    if (std::uint32_t a; require_values(1, "MAP") && pop_stream("MAP", a)) {
+        const ExprNode x = exprs_[a];
+        data_stack_.push_back(Value::expr(exprs_.add({ExprNode::Kind::Map, static_cast<std::uint8_t>(fn),
+                                                    x.integer && fn != MapFn::Sqrt, x.filtered, a, 0, x.length, {}})));
+    }
+}
+
+// FILTER cmp: ( a t -- e ) keep the elements x for which `x cmp t` holds
+void Interpreter::filter_word(Compare cmp) {
+    if (!require_values(2, "FILTER")) {
+        return;
+    }
+    Value t = data_stack_.back(); data_stack_.pop_back();
+    if (t.is_reference()) {
+        report("Error: FILTER needs a number to compare with, found " + to_string(t) + ".");
+        data_stack_.pop_back();
+        return;
+    }
+    if (std::uint32_t a; pop_stream("FILTER", a)) {
+        const ExprNode x = exprs_[a];
+        data_stack_.push_back(Value::expr(exprs_.add({ExprNode::Kind::Filter, static_cast<std::uint8_t>(cmp),
+                                                    x.integer, true, a, 0, x.length, t})));
+    }
+}
+
+template <typename To, typename From>
+void convert(To* to, const From* from, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        to[i] = static_cast<To>(from[i]);
+    }
+}
+
+// Source blocks are read in place unless the element type differs
+template <typename T>
+const T* Interpreter::load_block(std::uint32_t id, std::uint64_t start, std::size_t n, T* buffer) {
+    const Array& a = arrays_[id];
+    if (a.integer == std::is_integral_v<T>) {
+        return elements<T>(a) + start;
+    }
+    convert(buffer, elements<std::conditional_t<std::is_integral_v<T>, double, std::int64_t>>(a) + start, n);
+    return buffer;
+}
+
+// A DIM between building an expression and evaluating it can resize a source
+bool Interpreter::check_sources(const char* word, std::uint32_t root) {
+    if (exprs_.all_sources(root, [this](std::uint32_t id, std::uint64_t length) { return arrays_[id].length == length; })) {
+        return true;
+    }
+    report(std::string("Error: ") + word + ": an array was re-DIMmed after the expression using it was built.");
+    return false;
+}
+
+// Drop the graph once no expression is referenced from the stack, so a
+// pipeline evaluated in a loop does not grow it on every iteration
+void Interpreter::release_exprs() {
+    if (std::none_of(data_stack_.begin(), data_stack_.end(), [](Value v) { return v.is_expr(); })) {
+        exprs_.clear();
+    }
+}
+
+// Evaluate `root` into array `target` from element 0; returns the count
+template <typename T>
+std::uint64_t Interpreter::evaluate_into(std::uint32_t root, std::uint32_t target) {
+    const Array& to = arrays_[target];
+    std::uint64_t pos = 0;
+    exprs_.evaluate<T>(root, [this](auto... args) { return load_block<T>(args...); }, [&](const T* data, std::size_t n) {
+        if (to.integer) {
+            convert(elements<std::int64_t>(to) + pos, data, n);
+        } else {
+            convert(elements<double>(to) + pos, data, n);
+        }
+        pos += n;
+    });
+    return pos;
+}
+
+std::uint64_t Interpreter::evaluate_into(std::uint32_t root, std::uint32_t target) {
+    return exprs_[root].integer ? evaluate_into<std::int64_t>(root, target) : evaluate_into<double>(root, target);
+}
+
+// Fold `root` with `fn`, one kernel call per block; nullopt if it is empty
+// and `fn` has no identity
+template <typename T>
+std::optional<T> Interpreter::reduce_expr(ZipFn fn, std::uint32_t root) {
+    std::optional<T> acc;
+    exprs_.evaluate<T>(root, [this](auto... args) { return load_block<T>(args...); }, [&](const T* data, std::size_t n) {
+        if (n == 0) {
+            return;
+        }
+        T part = data[0];
+        switch (fn) {
+            case ZipFn::Add:
+                part = kernels::sum(data, n);
+                break;
+            case ZipFn::Max:
+                part = kernels::max(data, n);
+                break;
+            case ZipFn::Mul:
+                for (std::size_t i = 1; i < n; ++i) part *= data[i];
+                break;
+            case ZipFn::Min:
+                for (std::size_t i = 1; i < n; ++i) part = data[i] < part ? data[i] : part;
+                break;
+            case ZipFn::Sub:
+                break;
+        }
+        if (!acc) {
+            acc = part;
+        } else if (fn == ZipFn::Add) {
+            *acc += part;
+        } else if (fn == ZipFn::Mul) {
+            *acc *= part;
+        } else {
+            acc = (fn == ZipFn::Max) == (part > *acc) ? part : *acc;
+        }
+    });
+    if (!acc && (fn == ZipFn::Add || fn == ZipFn::Mul)) {
+        acc = fn == ZipFn::Add ? 0 : 1;
+    }
+    return acc;
+}
+
+// REDUCE f, ASUM, AMAX: ( a -- x )
+void Interpreter::array_reduce(const char* word, ZipFn fn) {
+    std::uint32_t root;
+    if (!require_values(1, word) || !pop_stream(word, root) || !check_sources(word, root)) {
+        return;
+    }
+    std::optional<Value> result;
+    if (exprs_[root].integer) {
+        if (auto r = reduce_expr<std::int64_t>(fn, root)) result = Value::integer(*r);
+    } else {
+        if (auto r = reduce_expr<double>(fn, root)) result = Value::real(*r);
+    }
+    if (result) {
+        data_stack_.push_back(*result);
+    } else {
+        report(std::string("Error: ") + word + " of an empty array.");
+    }
+    release_exprs();
+}
+
+// ADOT: ( a b -- x ) one dot kernel over two arrays of the same length
+// and element type; otherwise (expressions, mixed types) fused as
+// `a b * ASUM`
+void Interpreter::array_dot() {
+    if (!require_values(2, "ADOT")) {
+        return;
+    }
+    Value b = data_stack_.back(); data_stack_.pop_back();
+    Value a = data_stack_.back(); data_stack_.pop_back();
+    if (!a.is_reference() || !b.is_reference()) {
+        report("Error: ADOT expects two arrays.");
+        return;
+    }
+    if (a.is_array() && b.is_array() && a.as_array() < arrays_.size() && b.as_array() < arrays_.size()) {
+        const Array& x = arrays_[a.as_array()];
+        const Array& y = arrays_[b.as_array()];
+        if (x.integer == y.integer && x.length == y.length) {
+            data_stack_.push_back(x.integer ? Value::integer(kernels::dot(elements<std::int64_t>(x), elements<std::int64_t>(y), x.length))
+                                            : Value::real(kernels::dot(elements<double>(x), elements<double>(y), x.length)));
+            return;
+        }
+    }
+    if (array_zip("ADOT", ZipFn::Mul, a, b)) {
+        array_reduce("ADOT", ZipFn::Add);
+    }
+}
+
+// AFILL: ( a x -- ) set every element to x
+void Interpreter::array_fill() {
+    if (!require_values(2, "AFILL")) {
+        return;
+    }
+    Value x = data_stack_.back(); data_stack_.pop_back();
+    if (std::uint32_t a; pop_array("AFILL", a)) {
+        const Array& r = arrays_[a];
+        r.integer ? kernels::fill(elements<std::int64_t>(r), x.to_int(), r.length)
+                  : kernels::fill(elements<double>(r), x.to_double(), r.length);
+    }
+}
+
+// AIOTA: ( a -- ) set every element to its index
+void Interpreter::array_iota() {
+    if (std::uint32_t a; require_values(1, "AIOTA") && pop_array("AIOTA", a)) {
+        const Array& r = arrays_[a];
+        r.integer ? kernels::iota(elements<std::int64_t>(r), r.length) : kernels::iota(elements<double>(r), r.length);
+    }
+}
+
+// TO A (no index): ( a' -- ) copy a whole array, or evaluate an expression,
+// into A, resizing A to match
+void Interpreter::array_assign(std::uint32_t target) {
+    if (!require_values(1, "TO")) {
+        return;
+    }
+    if (Value v = data_stack_.back(); v.is_expr() && v.as_expr() < exprs_.size()) {
+        data_stack_.pop_back();
+        const ExprNode& e = exprs_[v.as_expr()];
+        if (!check_sources("TO", v.as_expr())) {
+            return;
+        }
+        if (e.filtered) {
+            // Only an upper bound on the length is known: evaluate into a
+            // temporary, then copy what passed the filter
+            if (auto tmp = new_temporary(e.length, e.integer)) {
+                arrays_[*tmp].length = evaluate_into(v.as_expr(), *tmp);
+                data_stack_.push_back(Value::array(*tmp));
+                array_assign(target);
+            }
+        } else {
+            // Sources are read before their block is written, so A may be
+            // one of them (`A 2 * TO A`)
+            if (arrays_[target].length != e.length) {
+                dim_array(arrays_[target], static_cast<std::int64_t>(e.length));
+            }
+            evaluate_into(v.as_expr(), target);
+        }
+        release_exprs();
+        return;
+    }
+    std::uint32_t source;
+    if (!pop_array("TO", source)) {
+        return;
+    }
+    if (arrays_[target].length != arrays_[source].length) {
+        dim_array(arrays_[target], static_cast<std::int64_t>(arrays_[source].length));
+    }
+    const Array& from = arrays_[source];
+    const Array& to = arrays_[target];
+    if (to.integer == from.integer) {
+        std::memcpy(elements<std::byte>(to), elements<std::byte>(from), from.length * CELL);
+    } else {
+        for (std::uint64_t i = 0; i < from.length; ++i) {
+            store_element(to, i, load_element(from, i));
+        }
+    }
+}
+
+void Interpreter::run(const Code& code, std::uint32_t line) {
+    SharedDictionary::Pin pin(reader_);
+    sampler_.begin_line(line);
+    execute(code);
+    release_temporaries();
+    if (sampler_.pending()) [[unlikely]] {
+        sampler_.drain();
+    }
+}
+
+// Run `call`, a call of the word `op arg`, timed if profiling is on
+template <typename Call>
+void Interpreter::profiled(Op op, std::uint32_t arg, Call call) {
+    if (!profiler_.on()) [[likely]] {
+        call();
+        return;
+    }
+    profiler_.enter(op, arg, data_stack_.size(), [&] { return word_name(op, arg); });
+    call();
+    profiler_.leave(data_stack_.size());
+}
+
+void Interpreter::execute(const Code& code) {
+    Sampler::Frame frame(sampler_, code);
+    const Instruction* instructions = code.instructions.data();
+    const std::size_t count = code.instructions.size();
+    for (std::size_t pc = 0; pc < count; ++pc) {
+        const Instruction& in = instructions[pc];
+        switch (in.op) {
+            case Op::Push:
+                data_stack_.push_back(in.value);
+                break;
+            case Op::Add:
+                add();
+                break;
+            case Op::Sub:
+                subtract();
+                break;
+            case Op::Mul:
+                multiply();
+                break;
+            case Op::FPush:
+                float_stack_.push_back(in.value.as_float());
+                break;
+            case Op::FAdd:
+                float_binary("F+", [](double a, double b) { return a + b; });
+                break;
+            case Op::FSub:
+                float_binary("F-", [](double a, double b) { return a - b; });
+                break;
+            case Op::FMul:
+                float_binary("F*", [](double a, double b) { return a * b; });
+                break;
+            case Op::FDiv:
+                float_binary("F/", [](double a, double b) { return a / b; });
+                break;
+            case Op::FPrint:
+                if (require_floats(1, "F.")) {
+                    out_ << float_stack_.back() << '\n';
+                    float_stack_.pop_back();
+                }
+                break;
+            case Op::FDup:
+                if (require_floats(1, "FDUP")) {
+                    float_stack_.push_back(float_stack_.back());
+                }
+                break;
+            case Op::FDrop:
+                if (require_floats(1, "FDROP")) {
+                    float_stack_.pop_back();
+                }
+                break;
+            case Op::FSwap:
+                if (require_floats(2, "FSWAP")) {
+                    std::swap(float_stack_[float_stack_.size() - 1], float_stack_[float_stack_.size() - 2]);
+                }
+                break;
+            case Op::ToFloat:
+                if (data_stack_.empty()) {
+                    report("Error: >F requires a value on the stack.");
+                } else {
+                    float_stack_.push_back(data_stack_.back().to_double());
+                    data_stack_.pop_back();
+                }
+                break;
+            case Op::FromFloat:
+                if (require_floats(1, "F>")) {
+                    data_stack_.push_back(Value::real(float_stack_.back()));
+                    float_stack_.pop_back();
+                }
+                break;
+            case Op::Here:
+                data_stack_.push_back(Value::integer(static_cast<std::int64_t>(heap_.here())));
+                break;
+            case Op::Allot:
+                if (require_values(1, "ALLOT")) {
+                    Value n = data_stack_.back(); data_stack_.pop_back();
+                    if (!n.is_int() || !heap_.allot(n.as_int())) {
+                        report("Error: ALLOT " + to_string(n) +
+                               " exceeds the heap.");
+                    }
+                }
+                break;
+            case Op::Cells:
+                if (require_values(1, "CELLS")) {
+                    Value n = data_stack_.back();
+                    data_stack_.back() = Value::integer(n.to_int() * static_cast<std::int64_t>(CELL));
+                }
+                break;
+            case Op::Fetch:
+                if (std::uint64_t addr; require_values(1, "@") && pop_address(CELL, "@", addr)) {
+                    data_stack_.push_back(Value::from_bits(heap_.load<std::uint64_t>(addr)));
+                }
+                break;
+            case Op::Store:
+                if (require_values(2, "!")) {
+                    if (std::uint64_t addr; pop_address(CELL, "!", addr)) {
+                        heap_.store(addr, data_stack_.back().bits());
+                    }
+                    data_stack_.pop_back();
+                }
+                break;
+            case Op::CFetch:
+                if (std::uint64_t addr; require_values(1, "C@") && pop_address(1, "C@", addr)) {
+                    data_stack_.push_back(Value::integer(heap_.load<std::uint8_t>(addr)));
+                }
+                break;
+            case Op::CStore:
+                if (require_values(2, "C!")) {
+                    if (std::uint64_t addr; pop_address(1, "C!", addr)) {
+                        heap_.store(addr, static_cast<std::uint8_t>(data_stack_.back().to_int()));
+                    }
+                    data_stack_.pop_back();
+                }
+                break;
+            case Op::Jump:
+                pc += static_cast<std::int32_t>(in.arg) - 1;
+                break;
+            case Op::ForBegin: {
+                if (!require_values(3, "FOR")) {
+                    pc += static_cast<std::int32_t>(in.arg) - 1;
+                    break;
+                }
+                std::int64_t step = data_stack_.back().to_int(); data_stack_.pop_back();
+                std::int64_t limit = data_stack_.back().to_int(); data_stack_.pop_back();
+                std::int64_t start = data_stack_.back().to_int(); data_stack_.pop_back();
+                if (step > 0 ? start > limit : start < limit) {
+                    pc += static_cast<std::int32_t>(in.arg) - 1;
+                } else {
+                    loop_stack_.push_back({start, limit, step});
+                }
+                break;
+            }
+            case Op::Next: {
+                LoopFrame& frame = loop_stack_.back();
+                frame.index += frame.step;
+                if (frame.step > 0 ? frame.index <= frame.limit : frame.index >= frame.limit) {
+                    pc += static_cast<std::int32_t>(in.arg) - 1;
+                } else {
+                    loop_stack_.pop_back();
+                }
+                break;
+            }
+            case Op::LoopIndex:
+                data_stack_.push_back(Value::integer(loop_stack_[loop_stack_.size() - 1 - in.slot].index));
+                break;
+            case Op::RangeCheck: {
+                const LoopFrame& frame = loop_stack_[loop_stack_.size() - 1 - in.slot];
+                const Array& array = arrays_[static_cast<std::size_t>(in.value.as_int())];
+                std::int64_t lo = std::min(frame.index, frame.limit);
+                std::int64_t hi = std::max(frame.index, frame.limit);
+                if (lo < 0 || static_cast<std::uint64_t>(hi) >= array.length) {
+                    pc += static_cast<std::int32_t>(in.arg) - 1;
+                }
+                break;
+            }
+            case Op::Dim: {
+                std::int64_t length = in.value.as_int();
+                if (length < 0) {
+                    if (!require_values(1, "DIM")) {
+                        break;
+                    }
+                    length = data_stack_.back().to_int() + 1;
+                    data_stack_.pop_back();
+                }
+                dim_array(arrays_[in.arg], length);
+                break;
+            }
+            case Op::ALoad:
+                if (require_values(1, "array load")) {
+                    std::int64_t index = data_stack_.back().to_int();
+                    data_stack_.pop_back();
+                    if (check_index(arrays_[in.arg], index, in.arg)) {
+                        data_stack_.push_back(load_element(arrays_[in.arg], static_cast<std::uint64_t>(index)));
+                    }
+                }
+                break;
+            case Op::AStore:
+                if (require_values(2, "TO")) {
+                    std::int64_t index = data_stack_.back().to_int();
+                    data_stack_.pop_back();
+                    if (check_index(arrays_[in.arg], index, in.arg)) {
+                        store_element(arrays_[in.arg], static_cast<std::uint64_t>(index), data_stack_.back());
+                    }
+                    data_stack_.pop_back();
+                }
+                break;
+            case Op::ALoadLoop:
+                data_stack_.push_back(load_element(arrays_[in.arg],
+                                                  static_cast<std::uint64_t>(loop_stack_[loop_stack_.size() - 1 - in.slot].index)));
+                break;
+            case Op::AStoreLoop:
+                if (require_values(1, "TO")) {
+                    store_element(arrays_[in.arg], static_cast<std::uint64_t>(loop_stack_[loop_stack_.size() - 1 - in.slot].index),
+                                  data_stack_.back());
+                    data_stack_.pop_back();
+                }
+                break;
+            case Op::Map:
+                map_word(static_cast<MapFn>(in.arg));
+                break;
+            case Op::Zip:
+                zip_word(static_cast<ZipFn>(in.arg));
+                break;
+            case Op::Filter:
+                filter_word(static_cast<Compare>(in.arg));
+                break;
+            case Op::Reduce:
+                array_reduce("REDUCE", static_cast<ZipFn>(in.arg));
+                break;
+            case Op::ASum:
+                array_reduce("ASUM", ZipFn::Add);
+                break;
+            case Op::AMax:
+                array_reduce("AMAX", ZipFn::Max);
+                break;
+            case Op::ADot:
+                array_dot();
+                break;
+            case Op::AFill:
+                array_fill();
+                break;
+            case Op::AIota:
+                array_iota();
+                break;
+            case Op::AAssign:
+                array_assign(in.arg);
+                break;
+            case Op::Call:
+                profiled(in.op, in.arg, [&] { reader_.version().builtins[in.arg](*this); });
+                break;
+            case Op::CallLocal:
+                profiled(in.op, in.arg, [&] { builtins_[in.arg](*this); });
+                break;
+            case Op::Exec:
+                profiled(in.op, in.arg, [&] { execute(*reader_.version().definitions[in.arg]); });
+                break;
+            case Op::ExecLocal: {
+                const Code& word = definition(in.arg);
+                profiled(in.op, in.arg, [&] { execute(word); });
+                break;
+            }
+            case Op::SaveImage:
+                save_image(code.strings[in.arg]);
+                break;
+            case Op::Profile:
+                profile(static_cast<ProfileCommand>(in.slot), code.strings[in.arg]);
+                break;
+            case Op::Sample:
+                sample(static_cast<ProfileCommand>(in.slot), code.strings[in.arg]);
+                break;
+            case Op::PerfBegin:
+                perf_begin();
+                break;
+            case Op::PerfEnd:
+                perf_end(code.strings[in.arg]);
+                break;
+            case Op::Now:
+                data_stack_.push_back(Value::integer(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - clock_epoch).count()));
+                break;
+            case Op::TimeBegin:
+                time_marks_.push_back(std::chrono::steady_clock::now());
+                break;
+            case Op::TimeEnd: {
+                const auto end = std::chrono::steady_clock::now();
+                const auto start = time_marks_.back();
+                time_marks_.pop_back();
+                data_stack_.push_back(Value::integer(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+                break;
+            }
+            case Op::BenchBegin:
+                bench_begin(in.value.as_int(), code.strings[in.arg]);
+                break;
+            case Op::BenchEnd:
+                if (bench_next()) {
+                    pc += static_cast<std::int32_t>(in.arg) - 1;
+                }
+                break;
+            case Op::Error:
+                report(code.strings[in.arg]);
+                break;
+        }
+    }
+}
+
+Code Interpreter::compile(std::string_view line) {
+    return compile(tokenize(line));
+}
+
+TokenizedLine Interpreter::tokenize(std::string_view line) {
+    using namespace cnomlite;
+
+    TokenizedLine tokens{line, {}, {}};
+    LineIndex source(line);
+
+    // Validate once; the parsers below assume well-formed UTF-8
+    if (auto bad = utf8_validate(line); bad != std::string_view::npos) {
+        auto loc = source.locate(bad);
+        tokens.error = std::to_string(loc.line) + ":" + std::to_string(loc.column) + ": invalid UTF-8 (byte " +
+                       std::to_string(bad) + ")";
+        return tokens;
+    }
+
+    auto result = split_parser(line);
+    if (auto success = std::get_if<ParseSuccess<std::vector<std::string_view>>>(&result)) {
+        tokens.words = std::move(success->value);
+    } else {
+        tokens.error = source.describe(std::get<ParseError>(result));
+    }
+    return tokens;
+}
+
+Code Interpreter::compile(const TokenizedLine& line) {
+    Code code;
+    if (!line.error.empty()) {
+        code.strings.push_back("Parse error: " + line.error);
+        code.instructions.push_back({Op::Error});
+        return code;
+    }
+    // Built lazily, only if something on this line reports an error
+    cnomlite::LineIndex source(line.line);
+    SharedDictionary::Pin pin(reader_);
+    Compiler(line.words, source, code, *this).compile();
+    return code;
+}
+
+// Remove the first line from `source` and return it without its line
+// ending (\n or \r\n)
+std::string_view Interpreter::take_line(std::string_view& source) {
+    std::size_t end = source.find('\n');
+    std::string_view line = source.substr(0, end);
+    source.remove_prefix(end == std::string_view::npos ? source.size() : end + 1);
+    if (line.ends_with('\r')) {
+        line.remove_suffix(1);
+    }
+    return line;
+}
+
+bool Interpreter::eval(std::string_view source) {
+    const std::size_t errors = errors_;
+    for (std::uint32_t n = 1; !source.empty(); ++n) {
+        run(compile(take_line(source)), n);
+    }
+    return errors_ == errors;
+}
+
+bool Interpreter::load_library(std::string source) {
+    const std::size_t errors = errors_;
+    auto text = std::make_shared<const std::string>(std::move(source));
+    std::string_view rest = *text;
+    for (std::uint32_t n = 1; !rest.empty(); ++n) {
+        std::string_view line = take_line(rest);
+        if (!index_definition(text, line)) {
+            run(compile(line), n);
+        }
+    }
+    return errors_ == errors;
+}
+
+// Index `line` if it is exactly `: NAME words ;`. The test is a byte scan,
+// and conservative: a line it is unsure of (another ';' anywhere, or a byte
+// that can start non-ASCII Unicode spacing) is compiled as usual, so
+// indexing splits words exactly as the tokenizer would and never changes
+// what a line means.
+bool Interpreter::index_definition(const std::shared_ptr<const std::string>& source, std::string_view line) {
+    // Every non-ASCII White_Space code point starts with one of these bytes
+    if (line.find_first_of("\xC2\xE1\xE2\xE3") != std::string_view::npos) {
+        return false;
+    }
+    auto blank = [](char c) { return cnomlite::is_space(c); };
+    while (!line.empty() && blank(line.front())) {
+        line.remove_prefix(1);
+    }
+    while (!line.empty() && blank(line.back())) {
+        line.remove_suffix(1);
+    }
+    if (line.size() < 5 || line[0] != ':' || !blank(line[1]) || line.back() != ';' || !blank(line[line.size() - 2]) ||
+        line.find(';') != line.size() - 1) {
+        return false;
+    }
+    std::string_view inner = line.substr(2, line.size() - 3);
+    std::size_t start = 0;
+    while (start < inner.size() && blank(inner[start])) {
+        ++start;
+    }
+    std::size_t end = start;
+    while (end < inner.size() && !blank(inner[end])) {
+        ++end;
+    }
+    if (start == end) {
+        return false;
+    }
+    auto id = static_cast<std::uint32_t>(definitions_.size());
+    definitions_.emplace_back();
+    pending_[id] = {source, inner.substr(start, end - start), inner.substr(end)};
+    dictionary_.insert_or_assign(std::string(inner.substr(start, end - start)), Word{Op::ExecLocal, id});
+    return true;
+}
+
+// Colon definition `id`, compiled now if it is still pending
+const Code& Interpreter::definition(std::uint32_t id) {
+    if (!definitions_[id]) {
+        auto node = pending_.extract(id);
+        const PendingDefinition& pending = node.mapped();
+        auto code = std::make_shared<Code>();
+        code->name = pending.name;
+        cnomlite::LineIndex source(*pending.source);
+        // Validate first: the word parser assumes well-formed UTF-8
+        if (auto bad = cnomlite::utf8_validate(pending.body); bad != std::string_view::npos) {
+            auto loc = source.locate(static_cast<std::size_t>(pending.body.data() - pending.source->data()) + bad);
+            code->strings.push_back("Parse error: " + std::to_string(loc.line) + ":" + std::to_string(loc.column) +
+                                    ": invalid UTF-8 in " + code->name);
+            code->instructions.push_back({Op::Error});
+        } else if (auto result = split_parser(pending.body);
+                   auto success = std::get_if<cnomlite::ParseSuccess<std::vector<std::string_view>>>(&result)) {
+            SharedDictionary::Pin pin(reader_);
+            Compiler(success->value, source, *code, *this, true).compile();
+        } else {
+            code->strings.push_back("Parse error: " + source.describe(std::get<cnomlite::ParseError>(result)));
+            code->instructions.push_back({Op::Error});
+        }
+        definitions_[id] = std::move(code);
+    }
+    return *definitions_[id];
+}
+
+} // namespace cbasic
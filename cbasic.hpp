@@ -0,0 +1,314 @@
+#pragma once
+
+#include "bytecode.hpp"
+#include "cnomlite.hpp"
+#include "dictionary.hpp"
+#include "memory.hpp"
+#include "output.hpp"
+#include "pipeline.hpp"
+#include "profile.hpp"
+#include "sample.hpp"
+#include "value.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace cbasic {
+
+// DIM array numbers by name. Names are resolved at compile time.
+using ArrayIds = std::unordered_map<std::string, std::uint32_t, WordHash, WordEqual>;
+
+// Cells are one Value wide
+inline constexpr std::uint64_t CELL = sizeof(Value);
+
+// -----------------------------
+// Interpreter
+// -----------------------------
+// Active FOR loops, innermost last
+struct LoopFrame {
+    std::int64_t index;
+    std::int64_t limit;
+    std::int64_t step;
+};
+
+// The builtin words, shared by every interpreter that does not bring its own
+std::shared_ptr<SharedDictionary> standard_dictionary();
+
+// A colon definition indexed by load_library() but not compiled yet: its
+// name and body words, as views into the library's source
+struct PendingDefinition {
+    std::shared_ptr<const std::string> source;
+    std::string_view name;
+    std::string_view body;
+};
+
+// A line validated and split into words, ready to compile. The words are
+// views into the line.
+struct TokenizedLine {
+    std::string_view line;
+    std::vector<std::string_view> words;
+    std::string error;        // set if the line could not be split
+    std::uint32_t number = 0;  // its 1-based line number in its input, if known
+};
+
+// A frozen copy of an interpreter's state between lines: its stacks, memory,
+// arrays and own words. Any number of interpreters can start from one, e.g.
+// after a startup script has loaded libraries and filled tables. They share
+// its memory pages copy-on-write (see HeapImage) and its colon definitions.
+struct InterpreterSnapshot {
+    explicit InterpreterSnapshot(const Heap& memory) : heap(memory) {}
+
+    std::shared_ptr<SharedDictionary> base;
+    std::vector<Value> data_stack;
+    std::vector<double> float_stack;
+    Dictionary dictionary;
+    std::vector<Builtin> builtins;
+    std::vector<std::shared_ptr<const Code>> definitions;
+    std::unordered_map<std::uint32_t, PendingDefinition> pending;
+    HeapImage heap;
+    std::vector<Array> arrays;
+    ArrayIds array_ids;
+    bool color = false;
+};
+
+// One CBASIC interpreter. It owns all of its state (stacks, memory, arrays
+// and its own words) and writes to its own output stream, so interpreters
+// are independent and several can run in one process, one per thread.
+//
+// Words are looked up in the interpreter's own dictionary first, then in a
+// shared base dictionary. Colon definitions and words registered on the
+// interpreter go into its own dictionary; share() publishes one to the base,
+// for every interpreter using it.
+class Interpreter {
+public:
+    explicit Interpreter(std::ostream& out = std::cout,
+                         std::shared_ptr<SharedDictionary> base = standard_dictionary());
+
+    Interpreter(const Interpreter&) = delete;
+    Interpreter& operator=(const Interpreter&) = delete;
+
+    // Compile and run a script line by line. False if any line reported
+    // an error; the lines after it still run, as in the REPL.
+    bool eval(std::string_view source);
+
+    // eval() through an on-disk cache of compiled scripts in `cache` (see
+    // cache.cpp): a script seen before, starting from the same words and
+    // arrays, runs without being parsed or compiled again
+    bool eval(std::string_view source, const std::filesystem::path& cache);
+
+    // eval() for a library of words. A line holding exactly one colon
+    // definition, `: NAME words ;`, is only indexed: its body is parsed and
+    // compiled on NAME's first call, so unused words cost almost nothing.
+    // Such a body's words are resolved when it is compiled rather than when
+    // the library is loaded, and its errors are reported by that first call.
+    bool load_library(std::string source);
+
+    // Compile one line. Parse and compile errors become Op::Error
+    // instructions, which report them when the code runs.
+    Code compile(std::string_view line);
+
+    // compile() in two steps. tokenize() needs no interpreter, so it can run
+    // on another thread while this one executes the previous line.
+    static TokenizedLine tokenize(std::string_view line);
+    Code compile(const TokenizedLine& line);
+
+    // Run compiled code, then free the line's temporaries. `line` is its
+    // 1-based line number in its source, which SAMPLE attributes samples
+    // to; 0 if it has none.
+    void run(const Code& code, std::uint32_t line = 0);
+
+    void register_command(std::string_view name, Builtin command);
+    void register_opcode(std::string_view name, Op op);
+    void alias(std::string_view existing, std::string_view alias_name);
+
+    // Move one of this interpreter's words to the base dictionary. Fails for
+    // definitions that use the interpreter's own arrays or words.
+    bool share(std::string_view name);
+
+    SharedDictionary& base() { return *base_; }
+
+    std::vector<Value>& data_stack() { return data_stack_; }
+    std::vector<double>& float_stack() { return float_stack_; }
+    OutputSink& out() { return out_; }
+
+    // Color the REPL's prompts, stack listings and errors with ANSI escapes
+    // (off by default, for embedding)
+    void set_color(bool color) { out_.set_color(color); }
+
+    // Output is buffered until the buffer fills or this is called
+    void flush() { out_.flush(); }
+
+    // Errors reported so far
+    std::size_t error_count() const { return errors_; }
+
+    // PROFILE and SAMPLE: ON, OFF, RESET, REPORT, or FOLDED `path`, for the
+    // word profiler (see profile.hpp) and the sampling profiler (see
+    // sample.hpp)
+    void profile(ProfileCommand command, const std::string& path = {});
+    void sample(ProfileCommand command, const std::string& path = {});
+
+    // --perf-counters: turn the word profiler on and count hardware events
+    // per word (see perf.hpp). False if counters are unavailable; words are
+    // then timed only, and counters().reason() says why.
+    bool perf_counters();
+    const PerfCounters& counters() const { return perf_; }
+
+    // Drop everything a script can create (stacks, arrays, memory, pending
+    // expressions, colon definitions, PROFILE and SAMPLE data, which are
+    // turned off) and the error count, keeping the registered words and the
+    // arenas' address space, so one interpreter can run many scripts
+    void reset();
+
+    // Freeze the current state. Taken between lines: the temporaries and
+    // pending expressions of a line in progress are not part of it.
+    std::shared_ptr<const InterpreterSnapshot> snapshot() const;
+
+    // Replace everything reset() drops, and this interpreter's own words,
+    // with the contents of `snapshot`. It must have the same base dictionary.
+    void restore(const InterpreterSnapshot& snapshot);
+
+    // A new interpreter starting from this one's current state
+    std::unique_ptr<Interpreter> fork(std::ostream& out) const;
+
+    // Write this interpreter's colon definitions, own words, arrays, stacks
+    // and memory to an image file, and load one back in place of them (see
+    // image.cpp). Words the image calls must exist with the same meaning in
+    // the loading interpreter. Both report an error and return false on
+    // failure.
+    bool save_image(const std::string& path);
+    bool load_image(const std::string& path);
+
+    // Words usable from builtins
+    void print_stack();
+    void add();
+    void subtract();
+    void multiply();
+    void push(Value value);
+    bool require_values(std::size_t count, const char* word);
+    void report(std::string_view message);
+
+private:
+    friend class Compiler;
+
+    static std::string_view take_line(std::string_view& source);
+    bool index_definition(const std::shared_ptr<const std::string>& source, std::string_view line);
+    const Code& definition(std::uint32_t id);
+    std::uint64_t compile_environment();
+    void execute(const Code& code);
+
+    // Profiling (see profile.cpp)
+    template <typename Call>
+    void profiled(Op op, std::uint32_t arg, Call call);
+    std::string word_name(Op op, std::uint32_t arg);
+    void stop_profiling();
+    void perf_begin();
+    void perf_end(const std::string& region);
+    void bench_begin(std::int64_t runs, const std::string& label);
+    bool bench_next();
+
+    bool require_floats(std::size_t count, const char* word);
+    template <typename F>
+    void float_binary(const char* word, F f);
+    bool pop_address(std::uint64_t width, const char* word, std::uint64_t& addr);
+
+    // Arrays
+    bool check_index(const Array& array, std::int64_t index, std::uint32_t id);
+    Heap& arena_of(const Array& array);
+    Value load_element(const Array& array, std::uint64_t index);
+    void store_element(const Array& array, std::uint64_t index, Value v);
+    template <typename T>
+    T* elements(const Array& array);
+    void dim_array(Array& array, std::int64_t length);
+    std::optional<std::uint32_t> new_temporary(std::uint64_t length, bool integer);
+    void release_temporaries();
+    bool pop_array(const char* word, std::uint32_t& id);
+    void array_fill();
+    void array_iota();
+    void array_assign(std::uint32_t target);
+
+    // Array pipelines
+    std::optional<std::uint32_t> expr_node(const char* word, Value v);
+    bool pop_stream(const char* word, std::uint32_t& node);
+    bool array_zip(const char* word, ZipFn fn, Value a, Value b);
+    void zip_word(ZipFn fn);
+    void map_word(MapFn fn);
+    void filter_word(Compare cmp);
+    template <typename T>
+    const T* load_block(std::uint32_t id, std::uint64_t start, std::size_t n, T* buffer);
+    bool check_sources(const char* word, std::uint32_t root);
+    void release_exprs();
+    template <typename T>
+    std::uint64_t evaluate_into(std::uint32_t root, std::uint32_t target);
+    std::uint64_t evaluate_into(std::uint32_t root, std::uint32_t target);
+    template <typename T>
+    std::optional<T> reduce_expr(ZipFn fn, std::uint32_t root);
+    void array_reduce(const char* word, ZipFn fn);
+    void array_dot();
+
+    OutputSink out_;
+    std::size_t errors_ = 0;
+
+    // The data stack, and the float stack of homogeneous doubles used by the F-words
+    std::vector<Value> data_stack_;
+    std::vector<double> float_stack_;
+
+    // The shared base dictionary, and this interpreter's own words keyed
+    // case-insensitively, with the builtins and colon definitions behind
+    // Op::CallLocal and Op::ExecLocal
+    std::shared_ptr<SharedDictionary> base_;
+    SharedDictionary::Reader reader_;
+    Dictionary dictionary_;
+    std::vector<Builtin> builtins_;
+    std::vector<std::shared_ptr<const Code>> definitions_;  // null while pending
+    std::unordered_map<std::uint32_t, PendingDefinition> pending_;
+
+    // Linear memory for HERE, ALLOT, @, !, C@ and C!, and a scratch arena
+    // for temporary arrays produced by array words
+    Heap heap_;
+    Heap scratch_;
+
+    // DIM arrays and temporaries, by number
+    std::vector<Array> arrays_;
+    ArrayIds array_ids_;
+    std::vector<std::uint32_t> temporaries_;
+
+    // Nodes of the lazy array expressions (see cbasic.cpp)
+    ExprGraph exprs_;
+
+    std::vector<LoopFrame> loop_stack_;
+
+    Profiler profiler_;
+    Sampler sampler_;
+
+    // Hardware counters, opened by the first PERF{ or perf_counters(), and
+    // the PERF{ regions running, innermost last
+    struct PerfMark {
+        std::chrono::steady_clock::time_point start;
+        PerfCounts counts;
+    };
+    PerfCounters perf_;
+    std::vector<PerfMark> perf_marks_;
+
+    // TIME{ and BENCH blocks running, innermost last. Every run of a BENCH
+    // block starts from the stacks as they were at BENCH.
+    struct BenchFrame {
+        const std::string* label;
+        std::int64_t warmup;  // runs left before timing starts
+        std::int64_t runs;
+        std::vector<std::int64_t> samples;  // nanoseconds per timed run
+        std::vector<Value> data_stack;
+        std::vector<double> float_stack;
+        std::chrono::steady_clock::time_point start;
+    };
+    std::vector<std::chrono::steady_clock::time_point> time_marks_;
+    std::vector<BenchFrame> benches_;
+};
+
+} // namespace cbasic
@@ -1,217 +1,707 @@
 #pragma once
 
+#include <algorithm>
+#include <cstring>
 #include <functional>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <optional>
-#include <cctype>
 #include <vector>
 #include <iostream>
+#include <cstdint>
 #include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace cnomlite {
 
+// -----------------------------
+// Character classes
+// -----------------------------
+// Locale-independent ASCII classes, looked up in a 256-entry table so the
+// hot paths are a load and a mask instead of a chain of comparisons. Unlike
+// std::isspace/std::isdigit these are usable during constant evaluation.
+    enum AsciiClass : std::uint8_t {
+        ASCII_SPACE    = 1 << 0,
+        ASCII_DIGIT    = 1 << 1,
+        ASCII_ALPHA    = 1 << 2,
+        ASCII_ID_START = 1 << 3,  // letters and '_'
+    };
+
+    inline constexpr auto ascii_classes = [] {
+        struct { std::uint8_t c[256]; } t{};
+        for (int i = 0; i < 256; ++i) {
+            std::uint8_t bits = 0;
+            if (i == ' ' || (i >= '\t' && i <= '\r')) bits |= ASCII_SPACE;
+            if (i >= '0' && i <= '9') bits |= ASCII_DIGIT;
+            if ((i >= 'A' && i <= 'Z') || (i >= 'a' && i <= 'z')) bits |= ASCII_ALPHA | ASCII_ID_START;
+            if (i == '_') bits |= ASCII_ID_START;
+            t.c[i] = bits;
+        }
+        return t;
+    }();
+
+    constexpr bool has_class(char c, std::uint8_t cls) {
+        return (ascii_classes.c[static_cast<unsigned char>(c)] & cls) != 0;
+    }
+
+    constexpr bool is_space(char c) {
+        return has_class(c, ASCII_SPACE);
+    }
+
+    constexpr bool is_digit(char c) {
+        return has_class(c, ASCII_DIGIT);
+    }
+
+    constexpr char to_lower(char c) {
+        return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+    }
+
+// ASCII case-insensitive equality, compared in place. Bytes outside A-Z/a-z
+// (including UTF-8 sequences) must match exactly. At runtime, inputs of 16
+// bytes or more are folded and compared 16 bytes at a time with SSE2.
+    constexpr bool iequals(std::string_view a, std::string_view b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        std::size_t i = 0;
+#if defined(__SSE2__)
+        if !consteval {
+            if (a.size() >= 16) {
+                auto fold = [](__m128i x) {
+                    const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('A' - 1)),
+                                                        _mm_cmplt_epi8(x, _mm_set1_epi8('Z' + 1)));
+                    return _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+                };
+                auto block_equal = [&](std::size_t at) {
+                    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a.data() + at));
+                    const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b.data() + at));
+                    return _mm_movemask_epi8(_mm_cmpeq_epi8(fold(x), fold(y))) == 0xFFFF;
+                };
+                for (; i + 16 <= a.size(); i += 16) {
+                    if (!block_equal(i)) {
+                        return false;
+                    }
+                }
+                // The tail is covered by one overlapping block
+                return i == a.size() || block_equal(a.size() - 16);
+            }
+        }
+#endif
+        for (; i < a.size(); ++i) {
+            if (to_lower(a[i]) != to_lower(b[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+// -----------------------------
+// UTF-8
+// -----------------------------
+// Input is validated once with utf8_validate; everything below it assumes
+// well-formed UTF-8 and takes an ASCII fast path per byte.
+
+// Byte offset of the first malformed sequence, or npos if `text` is valid
+// UTF-8 (no overlongs, surrogates or code points above U+10FFFF). At
+// runtime, runs of ASCII are skipped 16 bytes at a time with SSE2.
+    constexpr std::size_t utf8_validate(std::string_view text) {
+        const std::size_t n = text.size();
+        auto byte = [&](std::size_t k) { return static_cast<unsigned char>(text[k]); };
+        std::size_t i = 0;
+        while (i < n) {
+#if defined(__SSE2__)
+            if !consteval {
+                while (i + 16 <= n &&
+                       _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i))) == 0) {
+                    i += 16;
+                }
+                if (i >= n) {
+                    break;
+                }
+            }
+#endif
+            const unsigned char lead = byte(i);
+            if (lead < 0x80) {
+                ++i;
+                continue;
+            }
+            std::size_t len = 0;
+            unsigned char lo = 0x80, hi = 0xBF;  // valid range of the second byte
+            if (lead >= 0xC2 && lead <= 0xDF) {
+                len = 2;
+            } else if (lead >= 0xE0 && lead <= 0xEF) {
+                len = 3;
+                if (lead == 0xE0) lo = 0xA0;       // overlong
+                if (lead == 0xED) hi = 0x9F;       // surrogates
+            } else if (lead >= 0xF0 && lead <= 0xF4) {
+                len = 4;
+                if (lead == 0xF0) lo = 0x90;       // overlong
+                if (lead == 0xF4) hi = 0x8F;       // above U+10FFFF
+            } else {
+                return i;
+            }
+            if (i + len > n || byte(i + 1) < lo || byte(i + 1) > hi) {
+                return i;
+            }
+            for (std::size_t k = 2; k < len; ++k) {
+                if ((byte(i + k) & 0xC0) != 0x80) {
+                    return i;
+                }
+            }
+            i += len;
+        }
+        return std::string_view::npos;
+    }
+
+    struct CodePoint {
+        char32_t value;
+        std::size_t length;  // in bytes
+    };
+
+// Decode the code point at the start of non-empty, validated input
+    constexpr CodePoint decode_utf8(std::string_view input) {
+        const auto b0 = static_cast<unsigned char>(input[0]);
+        if (b0 < 0x80) {
+            return {b0, 1};
+        }
+        auto cont = [&](std::size_t k) { return static_cast<char32_t>(static_cast<unsigned char>(input[k]) & 0x3F); };
+        if (b0 < 0xE0) {
+            return {(static_cast<char32_t>(b0 & 0x1F) << 6) | cont(1), 2};
+        }
+        if (b0 < 0xF0) {
+            return {(static_cast<char32_t>(b0 & 0x0F) << 12) | (cont(1) << 6) | cont(2), 3};
+        }
+        return {(static_cast<char32_t>(b0 & 0x07) << 18) | (cont(1) << 12) | (cont(2) << 6) | cont(3), 4};
+    }
+
+// Unicode whitespace (White_Space property)
+    constexpr bool is_space(char32_t cp) {
+        if (cp < 0x80) {
+            return is_space(static_cast<char>(cp));
+        }
+        return cp == 0x85 || cp == 0xA0 || cp == 0x1680 || (cp >= 0x2000 && cp <= 0x200A) ||
+               cp == 0x2028 || cp == 0x2029 || cp == 0x202F || cp == 0x205F || cp == 0x3000;
+    }
+
+// Identifier classes in the spirit of UAX #31 (XID_Start/XID_Continue).
+// Non-ASCII letters are approximated by the letter blocks of the common
+// scripts rather than the full property tables.
+    constexpr bool is_id_start(char32_t cp) {
+        if (cp < 0x80) {
+            return has_class(static_cast<char>(cp), ASCII_ID_START);
+        }
+        return (cp >= 0xC0 && cp <= 0x24F && cp != 0xD7 && cp != 0xF7)  // Latin-1, Latin Extended
+            || (cp >= 0x370 && cp <= 0x3FF && cp != 0x37E && cp != 0x387)  // Greek
+            || (cp >= 0x400 && cp <= 0x52F)    // Cyrillic
+            || (cp >= 0x531 && cp <= 0x587)    // Armenian
+            || (cp >= 0x5D0 && cp <= 0x5EA)    // Hebrew
+            || (cp >= 0x620 && cp <= 0x64A)    // Arabic
+            || (cp >= 0x900 && cp <= 0xDFF)    // Indic scripts
+            || (cp >= 0xE01 && cp <= 0xE30)    // Thai
+            || (cp >= 0x10A0 && cp <= 0x10FF)  // Georgian
+            || (cp >= 0x1100 && cp <= 0x11FF)  // Hangul Jamo
+            || (cp >= 0x1E00 && cp <= 0x1FFF)  // Latin Extended Additional, Greek Extended
+            || (cp >= 0x3041 && cp <= 0x30FF && cp != 0x30FB)  // Hiragana, Katakana
+            || (cp >= 0x3400 && cp <= 0x4DBF)  // CJK Extension A
+            || (cp >= 0x4E00 && cp <= 0x9FFF)  // CJK Unified Ideographs
+            || (cp >= 0xAC00 && cp <= 0xD7A3)  // Hangul Syllables
+            || (cp >= 0xF900 && cp <= 0xFAFF)  // CJK Compatibility Ideographs
+            || (cp >= 0x20000 && cp <= 0x2FA1F);  // CJK Extensions B and later
+    }
+
+    constexpr bool is_id_continue(char32_t cp) {
+        if (cp < 0x80) {
+            return has_class(static_cast<char>(cp), ASCII_ID_START | ASCII_DIGIT);
+        }
+        return is_id_start(cp) || (cp >= 0x300 && cp <= 0x36F);  // combining diacritics
+    }
+
+// One static single-character string per byte value, so errors can refer to
+// an expected character without owning any storage.
+    inline constexpr auto char_table = [] {
+        struct { char c[256]; } t{};
+        for (int i = 0; i < 256; ++i) {
+            t.c[i] = static_cast<char>(i);
+        }
+        return t;
+    }();
+
+    constexpr std::string_view char_view(char c) {
+        return {&char_table.c[static_cast<unsigned char>(c)], 1};
+    }
+
 // -----------------------------
 // ParseResult and ParseSuccess
 // -----------------------------
+// Results are views into the parsed input, so their positions are implicit:
+// offset(source) recovers the byte offset within the text originally handed
+// to the parser at no cost on the success path.
+    constexpr std::size_t offset_in(std::string_view source, std::string_view at) {
+        return static_cast<std::size_t>(at.data() - source.data());
+    }
+
     template <typename T>
     struct ParseSuccess {
         T value;
-        std::string remaining;
+        std::string_view remaining;
+
+        // Byte offset in `source` where parsing stopped
+        constexpr std::size_t offset(std::string_view source) const {
+            return offset_in(source, remaining);
+        }
+    };
+
+// A ParseError describes what was expected and where the parser gave up.
+// Both fields are views (into static data or the input), so failing never
+// allocates and errors can be produced during constant evaluation; message()
+// renders the text at runtime.
+    struct ParseError {
+        std::string_view expected;  // literal text, or a description such as "digit"
+        std::string_view found;     // the input at the failure point
+        char quote = 0;             // quote around `expected`, 0 for descriptions
+
+        // Byte offset in `source` of the failure
+        constexpr std::size_t offset(std::string_view source) const {
+            return offset_in(source, found);
+        }
+
+        std::string message() const {
+            const char fq = quote == '"' ? '"' : '\'';
+            const std::size_t shown = quote == '"' ? expected.size() : 1;
+            std::string text = "Expected ";
+            if (quote) {
+                text += quote;
+                text += expected;
+                text += quote;
+            } else {
+                text += expected;
+            }
+            text += ", found ";
+            text += fq;
+            if (found.empty() && fq == '\'') {
+                text += "EOF";
+            } else {
+                text += found.substr(0, shown);
+            }
+            text += fq;
+            return text;
+        }
     };
 
     template <typename T>
-    using ParseResult = std::variant<ParseSuccess<T>, std::string>;
+    using ParseResult = std::variant<ParseSuccess<T>, ParseError>;
+
+    template <typename T>
+    constexpr std::size_t offset(const ParseResult<T>& r, std::string_view source) {
+        return std::visit([&](const auto& alt) { return alt.offset(source); }, r);
+    }
+
+// -----------------------------
+// Source locations
+// -----------------------------
+// Maps byte offsets to 1-based line and column (in code points). The table of
+// line starts is built on the first lookup, i.e. only when a diagnostic is
+// actually reported; `source` must outlive the index.
+    class LineIndex {
+    public:
+        struct Location {
+            std::size_t line;
+            std::size_t column;
+        };
+
+        explicit LineIndex(std::string_view source) : source_(source) {}
+
+        std::string_view source() const { return source_; }
+
+        Location locate(std::size_t offset) const {
+            offset = std::min(offset, source_.size());
+            if (!built_) {
+                build();
+            }
+            auto it = std::upper_bound(line_starts_.begin(), line_starts_.end(), offset);
+            const std::size_t start = *(it - 1);
+            std::size_t column = 1;
+            for (std::size_t i = start; i < offset; ++i) {
+                // count code points: skip UTF-8 continuation bytes
+                column += (static_cast<unsigned char>(source_[i]) & 0xC0) != 0x80;
+            }
+            return {static_cast<std::size_t>(it - line_starts_.begin()), column};
+        }
+
+        Location locate(const ParseError& error) const {
+            return locate(error.offset(source_));
+        }
+
+        // "line:column: message"
+        std::string describe(const ParseError& error) const {
+            auto loc = locate(error);
+            return std::to_string(loc.line) + ":" + std::to_string(loc.column) + ": " + error.message();
+        }
+
+    private:
+        void build() const {
+            line_starts_.push_back(0);
+            const char* base = source_.data();
+            const char* end = base + source_.size();
+            for (const char* p = base; p < end;) {
+                auto nl = static_cast<const char*>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+                if (!nl) {
+                    break;
+                }
+                line_starts_.push_back(static_cast<std::size_t>(nl - base) + 1);
+                p = nl + 1;
+            }
+            built_ = true;
+        }
+
+        std::string_view source_;
+        mutable std::vector<std::size_t> line_starts_;
+        mutable bool built_ = false;
+    };
 
 // -----------------------------
 // Parser definition
 // -----------------------------
-// A Parser<T> holds a std::function that takes a string and returns ParseResult<T>.
-    template <typename T>
+// A Parser<T, F> wraps a callable F that takes a string_view and returns
+// ParseResult<T>. Combinators keep the concrete callable type, so a grammar
+// built from them is a literal type and can run in constant evaluation.
+// Parser<T> (the default F) is the type-erased form for runtime use, e.g.
+// parser tables and recursive grammars; any Parser<T, F> converts to it.
+    template <typename T, typename F = std::function<ParseResult<T>(std::string_view)>>
     struct Parser {
         using result_type = T;
-        std::function<ParseResult<T>(const std::string&)> f;
+        F f;
 
-        ParseResult<T> operator()(const std::string& input) const {
+        constexpr ParseResult<T> operator()(std::string_view input) const {
             return f(input);
         }
     };
 
-// Helper function to build a Parser<T> from a lambda
+// Helper function to build a Parser<T, F> from a lambda
     template <typename T, typename F>
-    Parser<T> make_parser(F&& fn) {
-        return Parser<T>{std::function<ParseResult<T>(const std::string&)>(std::forward<F>(fn))};
+    constexpr auto make_parser(F&& fn) {
+        return Parser<T, std::decay_t<F>>{std::forward<F>(fn)};
     }
 
 // -----------------------------
 // Basic Parsers
 // -----------------------------
-    inline auto any_char = make_parser<char>([](const std::string& input) -> ParseResult<char> {
+    inline constexpr auto any_char = make_parser<char>([](std::string_view input) -> ParseResult<char> {
         if (input.empty()) {
-            return "Unexpected end of input";
+            return ParseError{"any character", input};
         }
         return ParseSuccess<char>{ input[0], input.substr(1) };
     });
 
-    inline auto char_p(char expected) {
-        return make_parser<char>([expected](const std::string& input) -> ParseResult<char> {
+    constexpr auto char_p(char expected) {
+        return make_parser<char>([expected](std::string_view input) -> ParseResult<char> {
             if (!input.empty() && input[0] == expected) {
                 return ParseSuccess<char>{ expected, input.substr(1) };
             }
-            std::string error = "Expected '";
-            error += expected;
-            error += "', found '";
-            error += (input.empty() ? "EOF" : std::string(1, input[0]));
-            error += "'";
-            return error;
+            return ParseError{char_view(expected), input, '\''};
+        });
+    }
+
+// `expected` must outlive the parser and its results (literals always do).
+    constexpr auto string_p(std::string_view expected) {
+        return make_parser<std::string_view>([expected](std::string_view input) -> ParseResult<std::string_view> {
+            if (input.starts_with(expected)) {
+                return ParseSuccess<std::string_view>{ expected, input.substr(expected.size()) };
+            }
+            return ParseError{expected, input, '"'};
         });
     }
 
-    inline auto string_p(const std::string& expected) {
-        return make_parser<std::string>([expected](const std::string& input) -> ParseResult<std::string> {
-            if (input.size() >= expected.size() && input.substr(0, expected.size()) == expected) {
-                return ParseSuccess<std::string>{ expected, input.substr(expected.size()) };
+// istring_p: like string_p, but ASCII case-insensitive. The value is the
+// matched slice of the input, in whatever case it was written.
+    constexpr auto istring_p(std::string_view expected) {
+        return make_parser<std::string_view>([expected](std::string_view input) -> ParseResult<std::string_view> {
+            if (input.size() >= expected.size() && iequals(input.substr(0, expected.size()), expected)) {
+                return ParseSuccess<std::string_view>{ input.substr(0, expected.size()), input.substr(expected.size()) };
             }
-            std::string found = input.size() >= expected.size() ? input.substr(0, expected.size()) : input;
-            return "Expected \"" + expected + "\", found \"" + found + "\"";
+            return ParseError{expected, input, '"'};
         });
     }
 
-    inline auto digit = make_parser<char>([](const std::string& input) -> ParseResult<char> {
-        if (!input.empty() && std::isdigit(static_cast<unsigned char>(input[0]))) {
+    inline constexpr auto digit = make_parser<char>([](std::string_view input) -> ParseResult<char> {
+        if (!input.empty() && is_digit(input[0])) {
             return ParseSuccess<char>{ input[0], input.substr(1) };
         }
-        std::string error = "Expected digit, found '";
-        error += (input.empty() ? "EOF" : std::string(1, input[0]));
-        error += "'";
-        return error;
+        return ParseError{"digit", input};
     });
 
-    inline auto whitespace_char = make_parser<char>([](const std::string& input) -> ParseResult<char> {
-        if (!input.empty() && std::isspace(static_cast<unsigned char>(input[0]))) {
+// take_while1: the longest non-empty prefix whose characters satisfy pred,
+// returned as a view into the input (no per-character allocation)
+    template <typename Pred>
+    constexpr auto take_while1(Pred pred, std::string_view description) {
+        return make_parser<std::string_view>([pred,description](std::string_view input) -> ParseResult<std::string_view> {
+            std::size_t n = 0;
+            while (n < input.size() && pred(input[n])) {
+                ++n;
+            }
+            if (n == 0) {
+                return ParseError{description, input};
+            }
+            return ParseSuccess<std::string_view>{ input.substr(0, n), input.substr(n) };
+        });
+    }
+
+    inline constexpr auto whitespace_char = make_parser<char>([](std::string_view input) -> ParseResult<char> {
+        if (!input.empty() && is_space(input[0])) {
             return ParseSuccess<char>{ input[0], input.substr(1) };
         }
-        std::string error = "Expected whitespace, found '";
-        error += (input.empty() ? "EOF" : std::string(1, input[0]));
-        error += "'";
-        return error;
+        return ParseError{"whitespace", input};
+    });
+
+// any_codepoint: one UTF-8 encoded code point (input must be validated)
+    inline constexpr auto any_codepoint = make_parser<char32_t>([](std::string_view input) -> ParseResult<char32_t> {
+        if (input.empty()) {
+            return ParseError{"any character", input};
+        }
+        auto cp = decode_utf8(input);
+        return ParseSuccess<char32_t>{ cp.value, input.substr(cp.length) };
     });
 
+// `expected` is the UTF-8 spelling of the code point, for messages and for
+// matching; it must outlive the parser (literals always do).
+    constexpr auto codepoint_p(std::string_view expected) {
+        return make_parser<char32_t>([expected](std::string_view input) -> ParseResult<char32_t> {
+            if (!expected.empty() && input.starts_with(expected)) {
+                return ParseSuccess<char32_t>{ decode_utf8(expected).value, input.substr(expected.size()) };
+            }
+            return ParseError{expected, input, '\''};
+        });
+    }
+
+// take_codepoints1: the longest non-empty prefix whose code points satisfy
+// pred, as a view into the input. ASCII bytes are classified without
+// decoding.
+    template <typename Pred>
+    constexpr auto take_codepoints1(Pred pred, std::string_view description) {
+        return make_parser<std::string_view>([pred,description](std::string_view input) -> ParseResult<std::string_view> {
+            std::size_t n = 0;
+            while (n < input.size()) {
+                const auto b = static_cast<unsigned char>(input[n]);
+                if (b < 0x80) {
+                    if (!pred(static_cast<char32_t>(b))) {
+                        break;
+                    }
+                    ++n;
+                } else {
+                    auto cp = decode_utf8(input.substr(n));
+                    if (!pred(cp.value)) {
+                        break;
+                    }
+                    n += cp.length;
+                }
+            }
+            if (n == 0) {
+                return ParseError{description, input};
+            }
+            return ParseSuccess<std::string_view>{ input.substr(0, n), input.substr(n) };
+        });
+    }
+
+// identifier: an identifier start code point followed by continue points
+    inline constexpr auto identifier = make_parser<std::string_view>([](std::string_view input) -> ParseResult<std::string_view> {
+        if (input.empty() || !is_id_start(decode_utf8(input).value)) {
+            return ParseError{"identifier", input};
+        }
+        auto rest = take_codepoints1([](char32_t cp) { return is_id_continue(cp); }, "identifier")(input);
+        return std::get<ParseSuccess<std::string_view>>(rest);
+    });
+
+// unicode_space: one or more Unicode whitespace code points
+    inline constexpr auto unicode_space = take_codepoints1([](char32_t cp) { return is_space(cp); }, "whitespace");
+
 // -----------------------------
 // Combinators
 // -----------------------------
 
 // map: Transform the result of a parser
     template <typename ParserA, typename F>
-    auto map(ParserA p, F f) {
+    constexpr auto map(ParserA p, F f) {
         using A = typename ParserA::result_type;
         using B = std::invoke_result_t<F,A>;
-        return make_parser<B>([p,f](const std::string& input) -> ParseResult<B> {
+        return make_parser<B>([p,f](std::string_view input) -> ParseResult<B> {
             auto r = p(input);
             if (auto ps = std::get_if<ParseSuccess<A>>(&r)) {
-                return ParseSuccess<B>{ f(ps->value), ps->remaining };
+                return ParseSuccess<B>{ f(std::move(ps->value)), ps->remaining };
             }
-            return std::get<std::string>(r);
+            return std::get<ParseError>(r);
         });
     }
 
 // bind: Chains parsers, second depends on first result
     template <typename ParserA, typename F>
-    auto bind(ParserA p, F f) {
+    constexpr auto bind(ParserA p, F f) {
         using A = typename ParserA::result_type;
         using ParserB = std::invoke_result_t<F,A>;
         using B = typename ParserB::result_type;
-        return make_parser<B>([p,f](const std::string& input) -> ParseResult<B> {
+        return make_parser<B>([p,f](std::string_view input) -> ParseResult<B> {
             auto r = p(input);
             if (auto ps = std::get_if<ParseSuccess<A>>(&r)) {
-                auto next = f(ps->value);
+                auto next = f(std::move(ps->value));
                 return next(ps->remaining);
             }
-            return std::get<std::string>(r);
+            return std::get<ParseError>(r);
         });
     }
 
 // sequence: run first, then second
     template <typename ParserA, typename ParserB>
-    auto sequence(ParserA p1, ParserB p2) {
+    constexpr auto sequence(ParserA p1, ParserB p2) {
         using A = typename ParserA::result_type;
         using B = typename ParserB::result_type;
-        return make_parser<std::pair<A,B>>([p1,p2](const std::string& input) -> ParseResult<std::pair<A,B>> {
+        return make_parser<std::pair<A,B>>([p1,p2](std::string_view input) -> ParseResult<std::pair<A,B>> {
             auto r1 = p1(input);
             if (auto ps1 = std::get_if<ParseSuccess<A>>(&r1)) {
                 auto r2 = p2(ps1->remaining);
                 if (auto ps2 = std::get_if<ParseSuccess<B>>(&r2)) {
-                    return ParseSuccess<std::pair<A,B>>{{ps1->value, ps2->value}, ps2->remaining};
+                    return ParseSuccess<std::pair<A,B>>{{std::move(ps1->value), std::move(ps2->value)}, ps2->remaining};
                 }
-                return std::get<std::string>(r2);
+                return std::get<ParseError>(r2);
             }
-            return std::get<std::string>(r1);
+            return std::get<ParseError>(r1);
         });
     }
 
-// choice: try multiple parsers, return first success
+// preceded: run first, discard its result, then second
+    template <typename ParserA, typename ParserB>
+    constexpr auto preceded(ParserA p1, ParserB p2) {
+        using A = typename ParserA::result_type;
+        using B = typename ParserB::result_type;
+        return make_parser<B>([p1,p2](std::string_view input) -> ParseResult<B> {
+            auto r1 = p1(input);
+            if (auto ps1 = std::get_if<ParseSuccess<A>>(&r1)) {
+                return p2(ps1->remaining);
+            }
+            return std::get<ParseError>(r1);
+        });
+    }
+
+// terminated: run first, then second, keep the first result
+    template <typename ParserA, typename ParserB>
+    constexpr auto terminated(ParserA p1, ParserB p2) {
+        using A = typename ParserA::result_type;
+        using B = typename ParserB::result_type;
+        return make_parser<A>([p1,p2](std::string_view input) -> ParseResult<A> {
+            auto r1 = p1(input);
+            if (auto ps1 = std::get_if<ParseSuccess<A>>(&r1)) {
+                auto r2 = p2(ps1->remaining);
+                if (auto ps2 = std::get_if<ParseSuccess<B>>(&r2)) {
+                    return ParseSuccess<A>{std::move(ps1->value), ps2->remaining};
+                }
+                return std::get<ParseError>(r2);
+            }
+            return std::get<ParseError>(r1);
+        });
+    }
+
+// choice: try multiple parsers, return first success. On failure the error
+// of the alternative that got furthest into the input is reported.
+    constexpr ParseError furthest(const ParseError& a, const ParseError& b) {
+        return b.found.size() < a.found.size() ? b : a;
+    }
+
+    template <typename ParserT, typename... Rest>
+    constexpr auto choice(ParserT first, Rest... rest) {
+        using T = typename ParserT::result_type;
+        static_assert((std::is_same_v<T, typename Rest::result_type> && ...),
+                      "choice alternatives must have the same result type");
+        return make_parser<T>([first,rest...](std::string_view input) -> ParseResult<T> {
+            auto r = first(input);
+            if (std::holds_alternative<ParseSuccess<T>>(r)) {
+                return r;
+            }
+            ParseError error = std::get<ParseError>(r);
+            bool matched = false;
+            auto attempt = [&](const auto& parser) {
+                auto ri = parser(input);
+                if (std::holds_alternative<ParseSuccess<T>>(ri)) {
+                    r = std::move(ri);
+                    matched = true;
+                } else {
+                    error = furthest(error, std::get<ParseError>(ri));
+                }
+                return matched;
+            };
+            (attempt(rest) || ...);
+            if (matched) {
+                return r;
+            }
+            return error;
+        });
+    }
+
+// Runtime form over a table of type-erased parsers.
     template <typename T>
     auto choice(const std::vector<Parser<T>>& parsers) {
-        return make_parser<T>([parsers](const std::string& input) -> ParseResult<T> {
-            std::string errors;
+        return make_parser<T>([parsers](std::string_view input) -> ParseResult<T> {
+            std::optional<ParseError> error;
             for (auto& parser : parsers) {
                 auto r = parser(input);
                 if (std::holds_alternative<ParseSuccess<T>>(r)) {
                     return r;
                 }
-                errors += std::get<std::string>(r) + " | ";
+                error = error ? furthest(*error, std::get<ParseError>(r)) : std::get<ParseError>(r);
             }
-            if (!errors.empty()) {
-                errors = errors.substr(0, errors.size() - 3);
+            if (!error) {
+                return ParseError{"one of no alternatives", input};
             }
-            return errors.empty() ? std::string("No alternatives matched") : errors;
+            return *error;
         });
     }
 
 // many: zero or more occurrences
     template <typename ParserT>
-    auto many(ParserT p) {
+    constexpr auto many(ParserT p) {
         using T = typename ParserT::result_type;
-        return make_parser<std::vector<T>>([p](const std::string& input) -> ParseResult<std::vector<T>> {
+        return make_parser<std::vector<T>>([p](std::string_view input) -> ParseResult<std::vector<T>> {
             std::vector<T> results;
-            std::string remaining = input;
+            std::string_view remaining = input;
             while (true) {
                 auto r = p(remaining);
                 if (auto ps = std::get_if<ParseSuccess<T>>(&r)) {
-                    results.push_back(ps->value);
+                    results.push_back(std::move(ps->value));
                     remaining = ps->remaining;
                 } else {
                     break;
                 }
             }
-            return ParseSuccess<std::vector<T>>{results, remaining};
+            return ParseSuccess<std::vector<T>>{std::move(results), remaining};
         });
     }
 
 // many1: one or more occurrences
     template <typename ParserT>
-    auto many1(ParserT p) {
+    constexpr auto many1(ParserT p) {
         using T = typename ParserT::result_type;
-        return make_parser<std::vector<T>>([p](const std::string& input) -> ParseResult<std::vector<T>> {
-            auto r = many(p)(input);
-            if (auto ps = std::get_if<ParseSuccess<std::vector<T>>>(&r)) {
-                if (ps->value.empty()) {
-                    return std::string("Expected at least one occurrence");
-                }
+        return make_parser<std::vector<T>>([p](std::string_view input) -> ParseResult<std::vector<T>> {
+            auto first = p(input);
+            if (auto ps = std::get_if<ParseSuccess<T>>(&first)) {
+                auto r = many(p)(ps->remaining);
+                auto& rest = std::get<ParseSuccess<std::vector<T>>>(r);
+                rest.value.insert(rest.value.begin(), std::move(ps->value));
                 return r;
             }
-            return r;
+            return std::get<ParseError>(first);
         });
     }
 
 // optional_p: zero or one occurrence
     template <typename ParserT>
-    auto optional_p(ParserT p) {
+    constexpr auto optional_p(ParserT p) {
         using T = typename ParserT::result_type;
-        return make_parser<std::optional<T>>([p](const std::string& input) -> ParseResult<std::optional<T>> {
+        return make_parser<std::optional<T>>([p](std::string_view input) -> ParseResult<std::optional<T>> {
             auto r = p(input);
             if (auto ps = std::get_if<ParseSuccess<T>>(&r)) {
-                return ParseSuccess<std::optional<T>>{ps->value, ps->remaining};
+                return ParseSuccess<std::optional<T>>{std::move(ps->value), ps->remaining};
             }
             // no consumption on failure
             return ParseSuccess<std::optional<T>>{std::nullopt, input};
@@ -220,19 +710,19 @@ namespace cnomlite {
 
 // sep_by: zero or more occurrences separated by a separator
     template <typename ParserT, typename SepParser>
-    auto sep_by(ParserT element, SepParser separator) {
+    constexpr auto sep_by(ParserT element, SepParser separator) {
         using T = typename ParserT::result_type;
-        return make_parser<std::vector<T>>([element,separator](const std::string& input) -> ParseResult<std::vector<T>> {
+        using S = typename SepParser::result_type;
+        return make_parser<std::vector<T>>([element,separator](std::string_view input) -> ParseResult<std::vector<T>> {
             std::vector<T> results;
-            std::string remaining = input;
+            std::string_view remaining = input;
             while (true) {
                 auto elem_r = element(remaining);
                 if (auto ps_elem = std::get_if<ParseSuccess<T>>(&elem_r)) {
-                    results.push_back(ps_elem->value);
+                    results.push_back(std::move(ps_elem->value));
                     remaining = ps_elem->remaining;
                     auto sep_r = separator(remaining);
-                    if (std::holds_alternative<ParseSuccess<typename SepParser::result_type>>(sep_r)) {
-                        auto ps_sep = std::get_if<ParseSuccess<typename SepParser::result_type>>(&sep_r);
+                    if (auto ps_sep = std::get_if<ParseSuccess<S>>(&sep_r)) {
                         remaining = ps_sep->remaining;
                     } else {
                         break;
@@ -241,18 +731,17 @@ namespace cnomlite {
                     break;
                 }
             }
-            return ParseSuccess<std::vector<T>>{results, remaining};
+            return ParseSuccess<std::vector<T>>{std::move(results), remaining};
         });
     }
 
 // -----------------------------
 // Utility and Higher-level Parsers
 // -----------------------------
-    inline auto whitespace = many(whitespace_char);
+    inline constexpr auto whitespace = many(whitespace_char);
 
     template <typename ParserT>
-    auto skip_ws(ParserT p) {
-        using T = typename ParserT::result_type;
+    constexpr auto skip_ws(ParserT p) {
         // bind whitespace, then ignore its result and return p
         return bind(whitespace, [p](const std::vector<char>&) {
             return p;
@@ -260,7 +749,7 @@ namespace cnomlite {
     }
 
 // integer parser: one or more digits -> int
-    inline auto integer_p = map(many1(digit), [](const std::vector<char>& digits) -> int {
+    inline constexpr auto integer_p = map(many1(digit), [](const std::vector<char>& digits) -> int {
         int value = 0;
         for (char c : digits) {
             value = value * 10 + (c - '0');
@@ -268,6 +757,21 @@ namespace cnomlite {
         return value;
     });
 
+// The combinators above are usable in constant evaluation.
+    static_assert([] {
+        auto r = sep_by(skip_ws(integer_p), skip_ws(char_p(',')))("10, 20,30 rest");
+        auto& ps = std::get<ParseSuccess<std::vector<int>>>(r);
+        return ps.value.size() == 3 && ps.value[2] == 30 && ps.remaining == " rest";
+    }());
+    static_assert([] {
+        auto r = choice(string_p("ADD"), string_p("SUB"))("SUB 1");
+        return std::get<ParseSuccess<std::string_view>>(r).remaining == " 1";
+    }());
+    static_assert(std::get<ParseSuccess<std::string_view>>(istring_p("print")("PrInT")).value == "PrInT");
+    static_assert(utf8_validate("Grüße, 世界") == std::string_view::npos);
+    static_assert(utf8_validate("ok\xC0\xAF") == 2);
+    static_assert(std::get<ParseSuccess<std::string_view>>(identifier("größe+1")).value == "größe");
+
 #ifdef CNOMLITE_EXAMPLE
 
     int main() {
@@ -285,14 +789,14 @@ namespace cnomlite {
         );
 
         // Expression parser: integer + integer -> sum
-        auto expr_p = make_parser<int>([&](const std::string& input) -> ParseResult<int> {
+        auto expr_p = make_parser<int>([&](std::string_view input) -> ParseResult<int> {
             auto seq = sequence(integer_p, plus_p);
             auto result = seq(input);
             if (std::holds_alternative<ParseSuccess<std::pair<int,int>>>(result)) {
                 auto s = std::get<ParseSuccess<std::pair<int,int>>>(result);
                 return ParseSuccess<int>{ s.value.first + s.value.second, s.remaining };
             }
-            return std::get<std::string>(result);
+            return std::get<ParseError>(result);
         });
 
         std::vector<std::string> test_inputs = {
@@ -310,7 +814,7 @@ namespace cnomlite {
                 std::cout << "Parsed result: " << ps->value << "\n";
                 std::cout << "Remaining: \"" << ps->remaining << "\"\n";
             } else {
-                std::cout << "Parse error: " << std::get<std::string>(r) << "\n";
+                std::cout << "Parse error: " << std::get<ParseError>(r).message() << "\n";
             }
             std::cout << "------------------------\n";
         }
@@ -327,7 +831,7 @@ namespace cnomlite {
             }
             std::cout << "\nRemaining: \"" << ps->remaining << "\"\n";
         } else {
-            std::cout << "Parse error: " << std::get<std::string>(list_result) << "\n";
+            std::cout << "Parse error: " << std::get<ParseError>(list_result).message() << "\n";
         }
 
         return 0;
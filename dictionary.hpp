@@ -0,0 +1,242 @@
+#pragma once
+
+#include "bytecode.hpp"
+#include "cnomlite.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace cbasic {
+
+// Case-insensitive hashing and equality for dictionary keys. Both are
+// transparent, so lookups take a std::string_view without building a key.
+struct WordHash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view word) const {
+        // FNV-1a over ASCII-lowercased bytes
+        std::size_t hash = 14695981039346656037ull;
+        for (char c : word) {
+            hash = (hash ^ static_cast<unsigned char>(cnomlite::to_lower(c))) * 1099511628211ull;
+        }
+        return hash;
+    }
+};
+
+struct WordEqual {
+    using is_transparent = void;
+    bool operator()(std::string_view a, std::string_view b) const {
+        return cnomlite::iequals(a, b);
+    }
+};
+
+// A dictionary entry: the opcode the compiler emits for the word, and for
+// calls the index of the builtin or definition it calls.
+struct Word {
+    Op op = Op::Call;
+    std::uint32_t arg = 0;
+};
+
+using Dictionary = std::unordered_map<std::string, Word, WordHash, WordEqual>;
+
+class Interpreter;
+
+// A builtin word, called with the interpreter running it
+using Builtin = std::function<void(Interpreter&)>;
+
+// -----------------------------
+// Shared dictionary
+// -----------------------------
+// One immutable version of a dictionary shared between interpreters: its
+// words, and the builtins (Op::Call) and colon definitions (Op::Exec) they
+// refer to. Versions only ever append builtins and definitions, so an index
+// compiled against one version means the same in every later one.
+struct DictionaryVersion {
+    Dictionary words;
+    std::vector<Builtin> builtins;
+    std::vector<std::shared_ptr<const Code>> definitions;
+};
+
+// A read-mostly dictionary shared by many interpreters, typically a standard
+// library of words. Readers never lock: they pin the current version for the
+// duration of a line and read it freely. Writers copy the current version,
+// change the copy and publish it with one atomic exchange; the old version
+// is freed by epoch-based reclamation once no reader can still be using it.
+//
+// Reclamation: pinning announces the global epoch in the reader's slot and
+// then loads the current version. A writer retires the version it replaced
+// with the epoch it then advances past, so any reader still holding that
+// version announced an epoch no newer than the retirement epoch; the version
+// is freed once every pinned slot has moved beyond it.
+class SharedDictionary {
+public:
+    static constexpr std::uint64_t IDLE = std::numeric_limits<std::uint64_t>::max();
+
+private:
+    // A reader's announced epoch, IDLE while it holds no pin
+    struct Slot {
+        std::atomic<std::uint64_t> epoch{IDLE};
+        bool used = false;
+    };
+
+public:
+    SharedDictionary() : current_(new DictionaryVersion) {}
+
+    ~SharedDictionary() {
+        delete current_.load();
+        for (auto& retired : retired_) {
+            delete retired.first;
+        }
+    }
+
+    SharedDictionary(const SharedDictionary&) = delete;
+    SharedDictionary& operator=(const SharedDictionary&) = delete;
+
+    // A registered reader, one per interpreter. Pins nest, so code running
+    // under a pin (a builtin calling eval) may pin again.
+    class Reader {
+    public:
+        explicit Reader(SharedDictionary& dictionary) : dictionary_(dictionary), slot_(&dictionary.acquire_slot()) {}
+
+        ~Reader() { dictionary_.release_slot(*slot_); }
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        const DictionaryVersion& pin() {
+            if (depth_++ == 0) {
+                slot_->epoch.store(dictionary_.epoch_.load());
+                version_ = dictionary_.current_.load();
+            }
+            return *version_;
+        }
+
+        void unpin() {
+            if (--depth_ == 0) {
+                slot_->epoch.store(IDLE, std::memory_order_release);
+                version_ = nullptr;
+            }
+        }
+
+        // The pinned version; only valid between pin() and unpin()
+        const DictionaryVersion& version() const { return *version_; }
+
+        SharedDictionary& dictionary() const { return dictionary_; }
+
+    private:
+        SharedDictionary& dictionary_;
+        Slot* slot_;
+        const DictionaryVersion* version_ = nullptr;
+        int depth_ = 0;
+    };
+
+    class Pin {
+    public:
+        explicit Pin(Reader& reader) : reader_(reader), version_(reader.pin()) {}
+        ~Pin() { reader_.unpin(); }
+
+        Pin(const Pin&) = delete;
+        Pin& operator=(const Pin&) = delete;
+
+        const DictionaryVersion& operator*() const { return version_; }
+        const DictionaryVersion* operator->() const { return &version_; }
+
+    private:
+        Reader& reader_;
+        const DictionaryVersion& version_;
+    };
+
+    // Publish a copy of the current version changed by `edit`. Writers are
+    // serialized; readers see either the old version or the new one.
+    template <typename Edit>
+    void publish(Edit edit) {
+        std::lock_guard lock(writer_);
+        auto next = std::make_unique<DictionaryVersion>(*current_.load());
+        edit(*next);
+        const DictionaryVersion* old = current_.exchange(next.release());
+        retired_.emplace_back(old, epoch_.fetch_add(1));
+        reclaim();
+    }
+
+    void register_command(std::string_view name, Builtin command) {
+        publish([&](DictionaryVersion& v) {
+            v.builtins.push_back(std::move(command));
+            v.words.insert_or_assign(std::string(name), Word{Op::Call, static_cast<std::uint32_t>(v.builtins.size() - 1)});
+        });
+    }
+
+    void register_opcode(std::string_view name, Op op) {
+        publish([&](DictionaryVersion& v) { v.words.insert_or_assign(std::string(name), Word{op, 0}); });
+    }
+
+    void define(std::string_view name, std::shared_ptr<const Code> code) {
+        publish([&](DictionaryVersion& v) {
+            v.definitions.push_back(std::move(code));
+            v.words.insert_or_assign(std::string(name), Word{Op::Exec, static_cast<std::uint32_t>(v.definitions.size() - 1)});
+        });
+    }
+
+    // False if `existing` is not a word
+    bool alias(std::string_view existing, std::string_view alias_name) {
+        bool found = false;
+        publish([&](DictionaryVersion& v) {
+            if (auto it = v.words.find(existing); it != v.words.end()) {
+                found = true;
+                v.words.insert_or_assign(std::string(alias_name), it->second);
+            }
+        });
+        return found;
+    }
+
+private:
+    Slot& acquire_slot() {
+        std::lock_guard lock(writer_);
+        for (Slot& slot : slots_) {
+            if (!slot.used) {
+                slot.used = true;
+                return slot;
+            }
+        }
+        Slot& slot = slots_.emplace_back();
+        slot.used = true;
+        return slot;
+    }
+
+    void release_slot(Slot& slot) {
+        std::lock_guard lock(writer_);
+        slot.epoch.store(IDLE);
+        slot.used = false;
+    }
+
+    // Free the retired versions no pinned reader can still see (writer_ held)
+    void reclaim() {
+        std::uint64_t oldest = IDLE;
+        for (const Slot& slot : slots_) {
+            oldest = std::min(oldest, slot.epoch.load());
+        }
+        std::erase_if(retired_, [&](const auto& retired) {
+            if (retired.second < oldest) {
+                delete retired.first;
+                return true;
+            }
+            return false;
+        });
+    }
+
+    std::atomic<const DictionaryVersion*> current_;
+    std::atomic<std::uint64_t> epoch_{0};
+    std::mutex writer_;
+    std::deque<Slot> slots_;  // stable addresses; only grows
+    std::vector<std::pair<const DictionaryVersion*, std::uint64_t>> retired_;
+};
+
+} // namespace cbasic
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace cbasic {
+
+// -----------------------------
+// Hashing
+// -----------------------------
+// XXH64 (xxHash, 64-bit variant): fast, well-distributed content hashes for
+// cache keys. Reads are little-endian, as on every target we build for.
+class XXHash64 {
+public:
+    static std::uint64_t hash(std::string_view data, std::uint64_t seed = 0) {
+        const auto* p = reinterpret_cast<const unsigned char*>(data.data());
+        const unsigned char* end = p + data.size();
+        std::uint64_t h;
+        if (data.size() >= 32) {
+            std::uint64_t v1 = seed + P1 + P2;
+            std::uint64_t v2 = seed + P2;
+            std::uint64_t v3 = seed;
+            std::uint64_t v4 = seed - P1;
+            for (; end - p >= 32; p += 32) {
+                v1 = round(v1, read64(p));
+                v2 = round(v2, read64(p + 8));
+                v3 = round(v3, read64(p + 16));
+                v4 = round(v4, read64(p + 24));
+            }
+            h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+            h = merge(h, v1);
+            h = merge(h, v2);
+            h = merge(h, v3);
+            h = merge(h, v4);
+        } else {
+            h = seed + P5;
+        }
+        h += data.size();
+        for (; end - p >= 8; p += 8) {
+            h ^= round(0, read64(p));
+            h = std::rotl(h, 27) * P1 + P4;
+        }
+        if (end - p >= 4) {
+            std::uint32_t k;
+            std::memcpy(&k, p, sizeof k);
+            h ^= k * P1;
+            h = std::rotl(h, 23) * P2 + P3;
+            p += 4;
+        }
+        for (; p < end; ++p) {
+            h ^= *p * P5;
+            h = std::rotl(h, 11) * P1;
+        }
+        h ^= h >> 33;
+        h *= P2;
+        h ^= h >> 29;
+        h *= P3;
+        h ^= h >> 32;
+        return h;
+    }
+
+private:
+    static constexpr std::uint64_t P1 = 0x9E3779B185EBCA87ull;
+    static constexpr std::uint64_t P2 = 0xC2B2AE3D27D4EB4Full;
+    static constexpr std::uint64_t P3 = 0x165667B19E3779F9ull;
+    static constexpr std::uint64_t P4 = 0x85EBCA77C2B2AE63ull;
+    static constexpr std::uint64_t P5 = 0x27D4EB2F165667C5ull;
+
+    static std::uint64_t read64(const unsigned char* p) {
+        std::uint64_t v;
+        std::memcpy(&v, p, sizeof v);
+        return v;
+    }
+
+    static std::uint64_t round(std::uint64_t acc, std::uint64_t input) {
+        return std::rotl(acc + input * P2, 31) * P1;
+    }
+
+    static std::uint64_t merge(std::uint64_t h, std::uint64_t v) {
+        return (h ^ round(0, v)) * P1 + P4;
+    }
+};
+
+} // namespace cbasic
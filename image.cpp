@@ -0,0 +1,366 @@
+#include "cbasic.hpp"
+#include "serial.hpp"
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <utility>
+
+#if CBASIC_HEAP_MMAP
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+namespace cbasic {
+
+// -----------------------------
+// Image files
+// -----------------------------
+// SAVE-IMAGE writes an interpreter's colon definitions, its own words,
+// arrays, stacks and heap to a file that `cbasic --image` (load_image)
+// maps back in, so library words are loaded without parsing or compiling.
+//
+// Layout: a fixed header, the metadata (below), then the heap, aligned so
+// that it can be mapped copy-on-write straight from the file into the
+// loading interpreter's heap.
+//
+// Bytecode is stored as raw instructions, except that calls into builtins
+// and shared definitions are relocated: their `arg` is an index into a table
+// of word names, resolved against the loading interpreter's dictionaries.
+// The format version must change whenever the layout or the Op numbering
+// does; images of another version are refused rather than misread.
+
+namespace {
+
+constexpr char IMAGE_MAGIC[8] = {'C', 'B', 'A', 'S', 'I', 'M', 'G', '\0'};
+constexpr std::uint32_t IMAGE_VERSION = 2;
+
+// Covers every page size in use, so the heap can be mapped anywhere
+constexpr std::uint64_t IMAGE_ALIGN = 64 * 1024;
+
+struct ImageHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t op_count;
+    std::uint32_t instruction_size;
+    std::uint32_t reserved;
+    std::uint64_t meta_offset;
+    std::uint64_t meta_size;
+    std::uint64_t heap_offset;
+    std::uint64_t heap_here;
+};
+
+std::uint64_t align_up(std::uint64_t n) {
+    return (n + IMAGE_ALIGN - 1) & ~(IMAGE_ALIGN - 1);
+}
+
+// The ops whose `arg` is relocated through the name table
+bool relocated(Op op) {
+    return op == Op::Call || op == Op::Exec || op == Op::CallLocal;
+}
+
+} // namespace
+
+bool Interpreter::save_image(const std::string& path) {
+    for (Value v : data_stack_) {
+        if ((v.is_array() && v.as_array() < arrays_.size() && arrays_[v.as_array()].temporary) || v.is_expr()) {
+            report("Error: SAVE-IMAGE cannot save array temporaries; store them with TO first.");
+            return false;
+        }
+    }
+
+    // Images hold compiled code only
+    for (std::uint32_t id = 0; id < definitions_.size(); ++id) {
+        definition(id);
+    }
+
+    // Names for the builtins and shared definitions the code calls
+    SharedDictionary::Pin base(reader_);
+    std::map<std::pair<Op, std::uint32_t>, std::string> names;
+    for (const auto& [name, word] : base->words) {
+        if (word.op == Op::Call || word.op == Op::Exec) {
+            names.try_emplace({word.op, word.arg}, name);
+        }
+    }
+    for (const auto& [name, word] : dictionary_) {
+        if (word.op == Op::CallLocal) {
+            names.try_emplace({word.op, word.arg}, name);
+        }
+    }
+    std::vector<std::pair<Op, std::string>> relocations;
+    std::map<std::pair<Op, std::uint32_t>, std::uint32_t> relocation_ids;
+    auto relocate = [&](Op op, std::uint32_t arg) -> std::optional<std::uint32_t> {
+        auto [it, inserted] = relocation_ids.try_emplace({op, arg}, static_cast<std::uint32_t>(relocations.size()));
+        if (inserted) {
+            auto name = names.find({op, arg});
+            if (name == names.end()) {
+                relocation_ids.erase(it);
+                return std::nullopt;
+            }
+            relocations.emplace_back(op, name->second);
+        }
+        return it->second;
+    };
+
+    ByteWriter body;
+    body.put(static_cast<std::uint32_t>(definitions_.size()));
+    for (const auto& code : definitions_) {
+        bool relocatable = put_code(body, *code, [&](Instruction& in) {
+            if (!relocated(in.op)) {
+                return true;
+            }
+            auto id = relocate(in.op, in.arg);
+            in.arg = id.value_or(0);
+            return id.has_value();
+        });
+        if (!relocatable) {
+            report("Error: SAVE-IMAGE: a definition calls a word that is no longer in the dictionary.");
+            return false;
+        }
+    }
+    // Host builtins are not saved; the loading host registers its own
+    std::uint32_t words = 0;
+    ByteWriter word_body;
+    for (const auto& [name, word] : dictionary_) {
+        if (word.op == Op::CallLocal) {
+            continue;
+        }
+        std::uint32_t arg = word.arg;
+        if (relocated(word.op)) {
+            auto id = relocate(word.op, word.arg);
+            if (!id) {
+                continue;  // an alias of a word that has since been replaced
+            }
+            arg = *id;
+        }
+        word_body.put(std::string_view(name));
+        word_body.put(word.op);
+        word_body.put(arg);
+        ++words;
+    }
+
+    ByteWriter meta;
+    meta.put(static_cast<std::uint32_t>(relocations.size()));
+    for (const auto& [op, name] : relocations) {
+        meta.put(op);
+        meta.put(std::string_view(name));
+    }
+    meta.put(static_cast<std::uint32_t>(data_stack_.size()));
+    for (Value v : data_stack_) {
+        meta.put(v.bits());
+    }
+    meta.put(static_cast<std::uint32_t>(float_stack_.size()));
+    for (double x : float_stack_) {
+        meta.put(x);
+    }
+    meta.put(static_cast<std::uint32_t>(arrays_.size()));
+    for (const Array& array : arrays_) {
+        const bool keep = !array.temporary;
+        meta.put(keep ? array.offset : std::uint64_t{0});
+        meta.put(keep ? array.length : std::uint64_t{0});
+        meta.put(static_cast<std::uint8_t>(array.integer));
+    }
+    meta.put(static_cast<std::uint32_t>(array_ids_.size()));
+    for (const auto& [name, id] : array_ids_) {
+        meta.put(std::string_view(name));
+        meta.put(id);
+    }
+
+    ImageHeader header{};
+    std::memcpy(header.magic, IMAGE_MAGIC, sizeof header.magic);
+    header.version = IMAGE_VERSION;
+    header.op_count = OP_COUNT;
+    header.instruction_size = sizeof(Instruction);
+    header.meta_offset = sizeof header;
+    header.meta_size = meta.bytes().size() + body.bytes().size() + sizeof words + word_body.bytes().size();
+    header.heap_offset = align_up(header.meta_offset + header.meta_size);
+    header.heap_here = heap_.here();
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof header);
+    file << meta.bytes() << body.bytes();
+    file.write(reinterpret_cast<const char*>(&words), sizeof words);
+    file << word_body.bytes();
+    // Pad to the heap, and the heap to a whole aligned block, so that every
+    // page the loader maps lies inside the file
+    const std::string zeros(IMAGE_ALIGN, '\0');
+    file.write(zeros.data(), static_cast<std::streamsize>(header.heap_offset - header.meta_offset - header.meta_size));
+    file.write(reinterpret_cast<const char*>(heap_.data()), static_cast<std::streamsize>(heap_.here()));
+    file.write(zeros.data(), static_cast<std::streamsize>(align_up(heap_.here()) - heap_.here()));
+    if (!file.flush()) {
+        report("Error: SAVE-IMAGE cannot write " + path + ".");
+        return false;
+    }
+    return true;
+}
+
+bool Interpreter::load_image(const std::string& path) {
+#if CBASIC_HEAP_MMAP
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info{};
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        report("Error: Cannot open image " + path + ".");
+        return false;
+    }
+    const auto size = static_cast<std::size_t>(info.st_size);
+    void* mapped = size >= sizeof(ImageHeader) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (mapped == MAP_FAILED) {
+        close(fd);
+        report("Error: " + path + " is not an image.");
+        return false;
+    }
+    // Unmapped and closed on every return below; the heap keeps its own
+    // descriptor and mapping
+    struct Release {
+        void* p;
+        std::size_t n;
+        int fd;
+        ~Release() {
+            munmap(p, n);
+            close(fd);
+        }
+    } release{mapped, size, fd};
+    const auto* data = static_cast<const char*>(mapped);
+
+    ImageHeader header;
+    std::memcpy(&header, data, sizeof header);
+    if (std::memcmp(header.magic, IMAGE_MAGIC, sizeof header.magic) != 0) {
+        report("Error: " + path + " is not an image.");
+        return false;
+    }
+    if (header.version != IMAGE_VERSION || header.op_count != OP_COUNT ||
+        header.instruction_size != sizeof(Instruction)) {
+        report("Error: " + path + " was saved by another version of cbasic.");
+        return false;
+    }
+    auto corrupt = [&] {
+        report("Error: Image " + path + " is corrupt.");
+        return false;
+    };
+    if (header.meta_offset > size || header.meta_size > size - header.meta_offset ||
+        header.heap_offset % IMAGE_ALIGN != 0 || header.heap_offset > size ||
+        align_up(header.heap_here) > size - header.heap_offset || header.heap_here > heap_.capacity()) {
+        return corrupt();
+    }
+
+    SharedDictionary::Pin base(reader_);
+    ByteReader in(data + header.meta_offset, static_cast<std::size_t>(header.meta_size));
+
+    // Resolve the names the code calls by in this interpreter's dictionaries
+    std::vector<std::uint32_t> targets(in.get_count(5));
+    for (auto& target : targets) {
+        const auto op = in.get<Op>();
+        const std::string name = in.get_string();
+        const Dictionary& words = op == Op::CallLocal ? dictionary_ : base->words;
+        auto it = words.find(name);
+        if (!in.ok() || !relocated(op)) {
+            return corrupt();
+        }
+        if (it == words.end() || it->second.op != op) {
+            report("Error: Image " + path + " needs the word " + name + ", which is missing or different here.");
+            return false;
+        }
+        target = it->second.arg;
+    }
+
+    std::vector<Value> data_stack(in.get_count(8));
+    for (Value& v : data_stack) {
+        v = Value::from_bits(in.get<std::uint64_t>());
+    }
+    std::vector<double> float_stack(in.get_count(8));
+    for (double& x : float_stack) {
+        x = in.get<double>();
+    }
+    std::vector<Array> arrays(in.get_count(17));
+    for (Array& array : arrays) {
+        array.offset = in.get<std::uint64_t>();
+        array.length = in.get<std::uint64_t>();
+        array.integer = in.get<std::uint8_t>() != 0;
+        if (array.length > header.heap_here / CELL || array.offset > header.heap_here - array.length * CELL) {
+            return corrupt();
+        }
+    }
+    ArrayIds array_ids;
+    for (std::uint32_t n = in.get_count(8); n > 0; --n) {
+        std::string name = in.get_string();
+        auto id = in.get<std::uint32_t>();
+        if (id >= arrays.size()) {
+            return corrupt();
+        }
+        array_ids.insert_or_assign(std::move(name), id);
+    }
+    // Arrays on the stack are DIM arrays; expressions never outlive a line
+    for (Value v : data_stack) {
+        if (v.is_expr() || (v.is_array() && v.as_array() >= arrays.size())) {
+            return corrupt();
+        }
+    }
+
+    std::vector<std::shared_ptr<const Code>> definitions(in.get_count(8));
+    for (auto& definition : definitions) {
+        definition = get_code(in, [&](Instruction& instruction) {
+            if (!relocated(instruction.op)) {
+                return true;
+            }
+            if (instruction.arg >= targets.size()) {
+                return false;
+            }
+            instruction.arg = targets[instruction.arg];
+            return true;
+        });
+        if (!definition) {
+            return corrupt();
+        }
+    }
+    for (const auto& definition : definitions) {
+        if (!valid_code(*definition, definitions.size(), arrays.size())) {
+            return corrupt();
+        }
+    }
+
+    std::vector<std::pair<std::string, Word>> words(in.get_count(9));
+    for (auto& [name, word] : words) {
+        name = in.get_string();
+        word.op = in.get<Op>();
+        word.arg = in.get<std::uint32_t>();
+        if (relocated(word.op)) {
+            if (word.arg >= targets.size()) {
+                return corrupt();
+            }
+            word.arg = targets[word.arg];
+        } else if (!valid_word(word.op, word.arg, definitions.size(), arrays.size())) {
+            return corrupt();
+        }
+    }
+    if (!in.ok()) {
+        return corrupt();
+    }
+
+    // Everything checks out: replace what restore() would
+    HeapImage memory(fd, header.heap_offset, header.heap_here);
+    sampler_.drain();
+    profiler_.forget_words();
+    std::erase_if(dictionary_, [](const auto& entry) { return entry.second.op != Op::CallLocal; });
+    for (auto& [name, word] : words) {
+        dictionary_.insert_or_assign(std::move(name), word);
+    }
+    definitions_ = std::move(definitions);
+    data_stack_ = std::move(data_stack);
+    float_stack_ = std::move(float_stack);
+    loop_stack_.clear();
+    exprs_.clear();
+    temporaries_.clear();
+    arrays_ = std::move(arrays);
+    array_ids_ = std::move(array_ids);
+    heap_.restore(memory);
+    scratch_.clear();
+    return true;
+#else
+    report("Error: Cannot load image " + path + ": images need memory-mapped files.");
+    return false;
+#endif
+}
+
+} // namespace cbasic
@@ -0,0 +1,178 @@
+#include "input.hpp"
+#include "ring.hpp"
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cbasic {
+
+namespace {
+
+// Most bytes the reader gathers into one chunk
+constexpr std::size_t CHUNK = std::size_t{64} << 10;
+
+// Most lines the tokenizer puts in one batch, so the executor can start on
+// a large chunk before all of it is split
+constexpr std::size_t BATCH_LINES = 256;
+
+// Chunks and batches in flight between stages
+constexpr std::size_t DEPTH = 16;
+
+// Whole lines of input. Null marks the end.
+using Chunk = std::unique_ptr<std::string>;
+
+// Lines split into words. The words are views into `text`.
+struct Batch {
+    std::shared_ptr<const std::string> text;
+    std::vector<TokenizedLine> lines;
+};
+
+// Null marks the end
+using BatchPtr = std::unique_ptr<Batch>;
+
+// `line` without its line ending (\n or \r\n)
+std::string_view strip_line(std::string_view line) {
+    if (line.ends_with('\n')) {
+        line.remove_suffix(1);
+    }
+    if (line.ends_with('\r')) {
+        line.remove_suffix(1);
+    }
+    return line;
+}
+
+// Read `in` in chunks of whole lines, up to EOF or EXIT. Reading blocks only
+// for the first byte of a chunk and then takes what is already waiting, so a
+// slow producer's lines are passed on as they arrive.
+void read_chunks(std::istream& in, SpscRing<Chunk, DEPTH>& chunks) {
+    std::string partial;  // an unfinished last line, continued by the next read
+    bool done = false;
+    while (!done) {
+        auto chunk = std::make_unique<std::string>(std::move(partial));
+        partial.clear();
+        const std::size_t start = chunk->size();
+        chunk->resize(start + CHUNK);
+        std::size_t size = start;
+        if (in.peek() != std::istream::traits_type::eof()) {
+            while (size < chunk->size()) {
+                const std::streamsize n = in.readsome(chunk->data() + size, static_cast<std::streamsize>(chunk->size() - size));
+                if (n <= 0) {
+                    break;
+                }
+                size += static_cast<std::size_t>(n);
+            }
+            if (size == start) {
+                // The stream cannot tell what is buffered; take one byte
+                in.get(chunk->data()[size++]);
+            }
+        } else {
+            done = true;
+        }
+        chunk->resize(size);
+
+        // Stop at EXIT, and carry the unfinished last line over
+        std::size_t line = 0;
+        std::size_t end;
+        while ((end = chunk->find('\n', line)) != std::string::npos) {
+            if (cnomlite::iequals(strip_line(std::string_view(*chunk).substr(line, end + 1 - line)), "EXIT")) {
+                chunk->resize(line);
+                done = true;
+                break;
+            }
+            line = end + 1;
+        }
+        if (!done) {
+            partial.assign(*chunk, line);
+            chunk->resize(line);
+        } else if (line < chunk->size() && cnomlite::iequals(strip_line(std::string_view(*chunk).substr(line)), "EXIT")) {
+            chunk->resize(line);  // EXIT on the last line, without a newline
+        }
+        if (!chunk->empty()) {
+            chunks.push(std::move(chunk));
+        }
+    }
+    chunks.push(nullptr);
+}
+
+// Split chunks into batches of tokenized lines
+void tokenize_chunks(SpscRing<Chunk, DEPTH>& chunks, SpscRing<BatchPtr, DEPTH>& batches) {
+    std::uint32_t number = 0;  // chunks hold whole lines, so this counts input lines
+    while (Chunk chunk = chunks.pop()) {
+        std::shared_ptr<const std::string> text = std::move(chunk);
+        std::string_view rest = *text;
+        auto batch = std::make_unique<Batch>();
+        batch->text = text;
+        while (!rest.empty()) {
+            const std::size_t end = rest.find('\n');
+            const std::size_t length = end == std::string_view::npos ? rest.size() : end + 1;
+            std::string_view line = strip_line(rest.substr(0, length));
+            rest.remove_prefix(length);
+            ++number;
+            if (line.empty()) {
+                continue;
+            }
+            batch->lines.push_back(Interpreter::tokenize(line));
+            batch->lines.back().number = number;
+            if (batch->lines.size() == BATCH_LINES) {
+                batches.push(std::move(batch));
+                batch = std::make_unique<Batch>();
+                batch->text = text;
+            }
+        }
+        if (!batch->lines.empty()) {
+            batches.push(std::move(batch));
+        }
+    }
+    batches.push(nullptr);
+}
+
+// One line at a time on the calling thread, for a single CPU, where the
+// stages could only take turns
+bool run_lines(Interpreter& interpreter, std::istream& in) {
+    bool ok = true;
+    std::string line;
+    for (std::uint32_t number = 1;; ++number) {
+        if (in.rdbuf()->in_avail() <= 0) {
+            interpreter.flush();
+        }
+        if (!std::getline(in, line) || cnomlite::iequals(strip_line(line), "EXIT")) {
+            break;
+        }
+        const std::size_t errors = interpreter.error_count();
+        interpreter.run(interpreter.compile(strip_line(line)), number);
+        ok = interpreter.error_count() == errors && ok;
+    }
+    return ok;
+}
+
+} // namespace
+
+bool run_input(Interpreter& interpreter, std::istream& in) {
+    if (std::thread::hardware_concurrency() == 1) {
+        return run_lines(interpreter, in);
+    }
+    SpscRing<Chunk, DEPTH> chunks;
+    SpscRing<BatchPtr, DEPTH> batches;
+    std::jthread reader([&] { read_chunks(in, chunks); });
+    std::jthread tokenizer([&] { tokenize_chunks(chunks, batches); });
+
+    bool ok = true;
+    while (true) {
+        if (batches.empty()) {
+            interpreter.flush();
+        }
+        BatchPtr batch = batches.pop();
+        if (!batch) {
+            break;
+        }
+        for (const TokenizedLine& line : batch->lines) {
+            const std::size_t errors = interpreter.error_count();
+            interpreter.run(interpreter.compile(line), line.number);
+            ok = interpreter.error_count() == errors && ok;
+        }
+    }
+    return ok;
+}
+
+} // namespace cbasic
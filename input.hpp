@@ -0,0 +1,26 @@
+#pragma once
+
+#include "cbasic.hpp"
+#include <istream>
+
+namespace cbasic {
+
+// -----------------------------
+// Piped input
+// -----------------------------
+// Run `in` line by line up to EOF or a line reading EXIT, as a REPL would
+// without its prompts, in a three-stage pipeline joined by SPSC rings:
+//   - a reader thread takes input in chunks of whole lines;
+//   - a tokenizer thread validates the lines and splits them into words;
+//   - the calling thread compiles and runs each line.
+// Reading and splitting later lines overlap running the current one.
+// Compiling stays on the calling thread, because a line can define words and
+// arrays that the next line uses. Lines therefore run, and report errors,
+// exactly as one eval() per line would. With a single CPU, all three
+// stages run one line at a time on the calling thread.
+//
+// Output is flushed whenever the next line has not arrived yet. Returns
+// false if any line reported an error.
+bool run_input(Interpreter& interpreter, std::istream& in);
+
+} // namespace cbasic
@@ -0,0 +1,118 @@
+#include "jobs.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <sstream>
+
+namespace cbasic {
+
+// One worker's jobs. The owner takes from the front, so it runs its share in
+// script order and the in-order emitter is rarely kept waiting; thieves take
+// from the back, the jobs the owner would reach last. Jobs are whole
+// scripts, so a short critical section per job costs nothing measurable.
+class JobQueue {
+public:
+    void push(std::size_t job) {
+        std::lock_guard lock(mutex_);
+        jobs_.push_back(job);
+    }
+
+    std::optional<std::size_t> pop() {
+        std::lock_guard lock(mutex_);
+        if (jobs_.empty()) {
+            return std::nullopt;
+        }
+        std::size_t job = jobs_.front();
+        jobs_.pop_front();
+        return job;
+    }
+
+    std::optional<std::size_t> steal() {
+        std::lock_guard lock(mutex_);
+        if (jobs_.empty()) {
+            return std::nullopt;
+        }
+        std::size_t job = jobs_.back();
+        jobs_.pop_back();
+        return job;
+    }
+
+private:
+    std::mutex mutex_;
+    std::deque<std::size_t> jobs_;
+};
+
+std::vector<JobResult> run_jobs(const std::vector<std::string>& scripts, const JobOptions& options) {
+    const std::size_t count = scripts.size();
+    const std::size_t workers = std::clamp<std::size_t>(options.workers, 1, std::max<std::size_t>(count, 1));
+
+    // Deal contiguous runs of jobs, so each worker starts in script order
+    std::vector<JobQueue> queues(workers);
+    for (std::size_t w = 0; w < workers; ++w) {
+        for (std::size_t job = w * count / workers; job < (w + 1) * count / workers; ++job) {
+            queues[w].push(job);
+        }
+    }
+
+    std::vector<JobResult> results(count);
+    std::vector<bool> done(count);
+    std::mutex done_mutex;
+    std::condition_variable finished;
+
+    auto work = [&](std::size_t self) {
+        std::ostringstream out;
+        Interpreter interpreter(out, options.start ? options.start->base : options.dictionary);
+        if (options.setup) {
+            options.setup(interpreter);
+        }
+        auto next = [&]() -> std::optional<std::size_t> {
+            if (auto job = queues[self].pop()) {
+                return job;
+            }
+            for (std::size_t k = 1; k < workers; ++k) {
+                if (auto job = queues[(self + k) % workers].steal()) {
+                    return job;
+                }
+            }
+            return std::nullopt;  // no job is ever added, so all are taken
+        };
+        while (auto job = next()) {
+            if (options.start) {
+                interpreter.restore(*options.start);
+            } else {
+                interpreter.reset();
+            }
+            bool ok = options.cache.empty() ? interpreter.eval(scripts[*job]) : interpreter.eval(scripts[*job], options.cache);
+            interpreter.flush();
+            results[*job] = {std::move(out).str(), ok};
+            out.str({});
+            {
+                std::lock_guard lock(done_mutex);
+                done[*job] = true;
+            }
+            finished.notify_all();
+        }
+    };
+
+    std::vector<std::jthread> threads;
+    threads.reserve(workers);
+    for (std::size_t w = 0; w < workers; ++w) {
+        threads.emplace_back(work, w);
+    }
+
+    if (options.emit) {
+        for (std::size_t job = 0; job < count; ++job) {
+            {
+                std::unique_lock lock(done_mutex);
+                finished.wait(lock, [&] { return done[job]; });
+            }
+            options.emit(job, results[job]);
+        }
+    }
+    threads.clear();  // join
+    return results;
+}
+
+} // namespace cbasic
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "cbasic.hpp"
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cbasic {
+
+// -----------------------------
+// Jobs
+// -----------------------------
+// Runs many independent scripts on a pool of worker threads. Each worker owns
+// one Interpreter (and so its own heap and scratch arena) and resets it
+// between jobs, so a job sees a fresh interpreter without paying for a new
+// one. Jobs are dealt out to per-worker queues up front; a worker that runs
+// out of its own jobs steals from the back of another worker's queue.
+
+struct JobResult {
+    std::string output;  // everything the script printed
+    bool ok = false;     // no line reported an error
+};
+
+struct JobOptions {
+    unsigned workers = std::thread::hardware_concurrency();
+
+    // The base dictionary every worker's interpreter reads; words published
+    // to it while the jobs run are seen from each job's next line on
+    std::shared_ptr<SharedDictionary> dictionary = standard_dictionary();
+
+    // Runs once on each worker's interpreter, e.g. to register builtins.
+    // State it leaves on the stacks or in memory does not survive a reset.
+    std::function<void(Interpreter&)> setup;
+
+    // If set, every job starts from this snapshot instead of a fresh
+    // interpreter, so a startup script runs once rather than once per job.
+    // Its base dictionary is used, and words registered by `setup` are
+    // replaced by the snapshot's.
+    std::shared_ptr<const InterpreterSnapshot> start;
+
+    // If set, scripts are compiled through this on-disk cache (see
+    // cache.cpp), so a script run again skips parsing and compilation
+    std::filesystem::path cache;
+
+    // Called on the calling thread with each result, in script order, as
+    // soon as that job and all before it have finished
+    std::function<void(std::size_t, const JobResult&)> emit;
+};
+
+// Run every script and return the results in script order
+std::vector<JobResult> run_jobs(const std::vector<std::string>& scripts, const JobOptions& options = {});
+
+} // namespace cbasic
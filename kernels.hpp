@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+// -----------------------------
+// Array kernels
+// -----------------------------
+// Whole-array loops behind the APL-style array words. Each kernel is written
+// once against 64-byte GCC vector types and compiled into one clone per
+// instruction set; the dynamic loader picks the best clone for the running
+// CPU (AVX-512, AVX2, SSE4.2, or the baseline). Vector code that is wider
+// than the selected ISA is split by the compiler, so every clone is correct.
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define CBASIC_KERNEL __attribute__((target_clones("avx512f", "avx2", "sse4.2", "default"), noinline))
+#else
+#define CBASIC_KERNEL
+#endif
+
+namespace cbasic::kernels {
+
+template <typename T>
+struct VecOf;
+
+template <>
+struct VecOf<double> {
+    typedef double type __attribute__((vector_size(64)));
+};
+
+template <>
+struct VecOf<std::int64_t> {
+    typedef std::int64_t type __attribute__((vector_size(64)));
+};
+
+template <typename T>
+using Vec = typename VecOf<T>::type;
+
+template <typename T>
+inline constexpr std::size_t LANES = sizeof(Vec<T>) / sizeof(T);
+
+// Vectors are passed by reference only: a 64-byte vector returned by value
+// would have a different ABI in each clone.
+template <typename T>
+inline void load(Vec<T>& v, const T* p) {
+    std::memcpy(&v, p, sizeof v);
+}
+
+template <typename T>
+inline void store(T* p, const Vec<T>& v) {
+    std::memcpy(p, &v, sizeof v);
+}
+
+// Body templates. They are inlined into the clones below, which is what
+// compiles them once per ISA. `f(x, y)` updates x in place (x += y, ...).
+template <typename T, typename F>
+inline void zip_with(const T* a, const T* b, T* out, std::size_t n, F f) {
+    std::size_t i = 0;
+    for (Vec<T> x, y; i + LANES<T> <= n; i += LANES<T>) {
+        load(x, a + i);
+        load(y, b + i);
+        f(x, y);
+        store(out + i, x);
+    }
+    for (; i < n; ++i) {
+        T x = a[i];
+        f(x, b[i]);
+        out[i] = x;
+    }
+}
+
+template <typename T, typename F>
+inline void map_scalar(const T* a, T s, T* out, std::size_t n, F f) {
+    Vec<T> vs{};
+    vs += s;
+    std::size_t i = 0;
+    for (Vec<T> x; i + LANES<T> <= n; i += LANES<T>) {
+        load(x, a + i);
+        f(x, vs);
+        store(out + i, x);
+    }
+    for (; i < n; ++i) {
+        T x = a[i];
+        f(x, s);
+        out[i] = x;
+    }
+}
+
+template <typename T>
+inline T sum_body(const T* a, std::size_t n) {
+    Vec<T> acc0{}, acc1{};
+    std::size_t i = 0;
+    for (Vec<T> x, y; i + 2 * LANES<T> <= n; i += 2 * LANES<T>) {
+        load(x, a + i);
+        load(y, a + i + LANES<T>);
+        acc0 += x;
+        acc1 += y;
+    }
+    acc0 += acc1;
+    T total = 0;
+    for (std::size_t k = 0; k < LANES<T>; ++k) {
+        total += acc0[k];
+    }
+    for (; i < n; ++i) {
+        total += a[i];
+    }
+    return total;
+}
+
+template <typename T>
+inline T max_body(const T* a, std::size_t n) {
+    T best = std::numeric_limits<T>::lowest();
+    std::size_t i = 0;
+    if (n >= LANES<T>) {
+        Vec<T> acc, v;
+        load(acc, a);
+        for (i = LANES<T>; i + LANES<T> <= n; i += LANES<T>) {
+            load(v, a + i);
+            acc = v > acc ? v : acc;
+        }
+        for (std::size_t k = 0; k < LANES<T>; ++k) {
+            best = acc[k] > best ? acc[k] : best;
+        }
+    }
+    for (; i < n; ++i) {
+        best = a[i] > best ? a[i] : best;
+    }
+    return best;
+}
+
+template <typename T>
+inline T dot_body(const T* a, const T* b, std::size_t n) {
+    Vec<T> acc{};
+    std::size_t i = 0;
+    for (Vec<T> x, y; i + LANES<T> <= n; i += LANES<T>) {
+        load(x, a + i);
+        load(y, b + i);
+        acc += x * y;
+    }
+    T total = 0;
+    for (std::size_t k = 0; k < LANES<T>; ++k) {
+        total += acc[k];
+    }
+    for (; i < n; ++i) {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+template <typename T>
+inline void iota_body(T* out, std::size_t n) {
+    Vec<T> v;
+    for (std::size_t k = 0; k < LANES<T>; ++k) {
+        v[k] = static_cast<T>(k);
+    }
+    Vec<T> step{};
+    step += static_cast<T>(LANES<T>);
+    std::size_t i = 0;
+    for (; i + LANES<T> <= n; i += LANES<T>) {
+        store(out + i, v);
+        v += step;
+    }
+    for (; i < n; ++i) {
+        out[i] = static_cast<T>(i);
+    }
+}
+
+// The dispatched kernels, for double and int64 elements
+#define CBASIC_DEFINE_KERNELS(T)                                                                              \
+    CBASIC_KERNEL inline void add(const T* a, const T* b, T* out, std::size_t n) {                           \
+        zip_with(a, b, out, n, [](auto& x, const auto& y) { x += y; });                                       \
+    }                                                                                                         \
+    CBASIC_KERNEL inline void add(const T* a, T s, T* out, std::size_t n) {                                  \
+        map_scalar(a, s, out, n, [](auto& x, const auto& y) { x += y; });                                     \
+    }                                                                                                         \
+    CBASIC_KERNEL inline void sub(const T* a, const T* b, T* out, std::size_t n) {                           \
+        zip_with(a, b, out, n, [](auto& x, const auto& y) { x -= y; });                                       \
+    }                                                                                                         \
+    CBASIC_KERNEL inline void sub(const T* a, T s, T* out, std::size_t n) {                                  \
+        map_scalar(a, s, out, n, [](auto& x, const auto& y) { x -= y; });                                     \
+    }                                                                                                         \
+    CBASIC_KERNEL inline void mul(const T* a, const T* b, T* out, std::size_t n) {                           \
+        zip_with(a, b, out, n, [](auto& x, const auto& y) { x *= y; });                                       \
+    }                                                                                                         \
+    CBASIC_KERNEL inline void mul(const T* a, T s, T* out, std::size_t n) {                                  \
+        map_scalar(a, s, out, n, [](auto& x, const auto& y) { x *= y; });                                     \
+    }                                                                                                         \
+    CBASIC_KERNEL inline T sum(const T* a, std::size_t n) { return sum_body(a, n); }                         \
+    CBASIC_KERNEL inline T max(const T* a, std::size_t n) { return max_body(a, n); }                         \
+    CBASIC_KERNEL inline T dot(const T* a, const T* b, std::size_t n) { return dot_body(a, b, n); }          \
+    CBASIC_KERNEL inline void fill(T* out, T x, std::size_t n) {                                             \
+        map_scalar(out, x, out, n, [](auto& x, const auto& y) { x = y; });                                    \
+    }                                                                                                         \
+    CBASIC_KERNEL inline void iota(T* out, std::size_t n) { iota_body(out, n); }
+
+CBASIC_DEFINE_KERNELS(double)
+CBASIC_DEFINE_KERNELS(std::int64_t)
+
+#undef CBASIC_DEFINE_KERNELS
+
+} // namespace cbasic::kernels
@@ -1,189 +1,227 @@
-#include "cnomlite.hpp"
+#include "cbasic.hpp"
+#include "input.hpp"
+#include "jobs.hpp"
+#include <charconv>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
-#include <functional>
-#include <sstream>
-
-// ANSI Color Utility
-class ANSIColor {
-public:
-    static constexpr const char* RESET = "\033[0m";
-    static constexpr const char* RED = "\033[31m";
-    static constexpr const char* GREEN = "\033[32m";
-    static constexpr const char* BLUE = "\033[34m";
-    static constexpr const char* CYAN = "\033[36m";
-    static constexpr const char* MAGENTA = "\033[35m";
-    static constexpr const char* YELLOW = "\033[33m";
-    static constexpr const char* BOLD = "\033[1m";
-
-    static std::string apply(const std::string& text, const char* color) {
-        return std::string(color) + text + RESET;
-    }
-};
-
-void register_command_case_insensitive(
-    std::unordered_map<std::string, std::function<void()>>& map,
-    const std::string& name,
-    const std::function<void()>& command);
-void alias(std::unordered_map<std::string, std::function<void()>>& map, const char* existing, const char* alias_name);
-
-namespace cbasic {
 
-// The data stack for CBASIC
-std::vector<int> data_stack;
+#if defined(_WIN32)
+#include <io.h>
+#define isatty _isatty
+#define STDIN_FILENO 0
+#else
+#include <unistd.h>
+#endif
 
-// The environment (dictionary of words/commands)
-std::unordered_map<std::string, std::function<void()>> environment;
-
-// Helper: Print the stack contents
-void print_stack() {
-    std::cout << ANSIColor::apply("Stack: ", ANSIColor::GREEN);
-    for (const auto& item : data_stack) {
-        std::cout << item << " ";
-    }
-    std::cout << std::endl;
+// Startup Banner
+void print_startup_banner(cbasic::OutputSink& out) {
+    using cbasic::Color;
+    out.paint<Color::Cyan>("========================================") << '\n';
+    out.paint<Color::Green>("        WELCOME TO CBASIC REPL") << '\n';
+    out.paint<Color::Magenta>("        A Very Cool Experience") << '\n';
+    out.paint<Color::Cyan>("========================================") << '\n';
+    out.paint<Color::Yellow>("Type 'EXIT' to quit or 'PRINT' to see the stack.") << '\n';
+    out << '\n';
 }
 
-// Basic words for CBASIC
-void add() {
-    if (data_stack.size() < 2) {
-        std::cout << ANSIColor::apply("Error: ADD requires at least two values on the stack.", ANSIColor::RED) << std::endl;
-        return;
+bool read_file(const std::string& path, std::string& text) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "cbasic: cannot open " << path << std::endl;
+        return false;
     }
-    int b = data_stack.back(); data_stack.pop_back();
-    int a = data_stack.back(); data_stack.pop_back();
-    data_stack.push_back(a + b);
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    text = std::move(contents).str();
+    return true;
 }
 
-void subtract() {
-    if (data_stack.size() < 2) {
-        std::cout << ANSIColor::apply("Error: SUBTRACT requires at least two values on the stack.", ANSIColor::RED) << std::endl;
-        return;
+// cbasic [--image FILE] --jobs N [--prelude FILE] [--cache DIR] script...:
+// run the scripts in parallel on N threads and print each one's output in
+// order. The image is loaded and the prelude run once, as a library whose
+// definitions compile on first use, and every script starts from the state
+// they leave. With --cache, compiled scripts are kept in DIR and reused
+// while their source is unchanged. Fails if any script (or the prelude)
+// reported an error.
+int run_scripts(unsigned workers, const std::string& image, const std::string& prelude, const std::string& cache,
+                const std::vector<std::string>& paths) {
+    std::vector<std::string> scripts(paths.size());
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        if (!read_file(paths[i], scripts[i])) {
+            return 1;
+        }
     }
-    int b = data_stack.back(); data_stack.pop_back();
-    int a = data_stack.back(); data_stack.pop_back();
-    data_stack.push_back(a - b);
-}
-
-void push(int value) {
-    data_stack.push_back(value);
+    bool ok = true;
+    cbasic::JobOptions options;
+    options.workers = workers;
+    options.cache = cache;
+    if (!image.empty() || !prelude.empty()) {
+        cbasic::Interpreter interpreter;
+        if (!image.empty() && !interpreter.load_image(image)) {
+            return 1;
+        }
+        if (!prelude.empty()) {
+            std::string text;
+            if (!read_file(prelude, text)) {
+                return 1;
+            }
+            ok = interpreter.load_library(std::move(text));
+        }
+        options.start = interpreter.snapshot();
+    }
+    options.emit = [&](std::size_t, const cbasic::JobResult& result) {
+        std::cout << result.output << std::flush;
+        ok = ok && result.ok;
+    };
+    cbasic::run_jobs(scripts, options);
+    return ok ? 0 : 1;
 }
 
-// Parsing and executing commands
-void execute_word(const std::string& word) {
-    if (environment.find(word) != environment.end()) {
-        environment[word]();
-    } else {
-        std::cout << ANSIColor::apply("Error: Unknown command '" + word + "'", ANSIColor::RED) << std::endl;
+// cbasic [--image FILE] [--prelude FILE] [--cache DIR] script...: run the
+// scripts in order in one interpreter, without prompts or colors. Fails if
+// any line reported an error.
+int run_batch(cbasic::Interpreter& interpreter, const std::string& cache, const std::vector<std::string>& paths) {
+    bool ok = true;
+    for (const auto& path : paths) {
+        std::string text;
+        if (!read_file(path, text)) {
+            return 1;
+        }
+        ok = (cache.empty() ? interpreter.eval(text) : interpreter.eval(text, cache)) && ok;
     }
+    return ok ? 0 : 1;
 }
 
-void execute_line(const std::string& line) {
-    using namespace cnomlite;
+void print_usage() {
+    std::cerr << "usage: cbasic [--image FILE] [--prelude FILE] [--cache DIR] [--sample FILE] [--perf-counters]\n"
+                 "              [script...]\n"
+                 "       cbasic [--image FILE] --jobs N [--prelude FILE] [--cache DIR] script..."
+              << std::endl;
+}
 
-    // Define a parser for a word: one or more non-whitespace characters
-    auto word_parser = many1(make_parser<char>([](const std::string& input) -> ParseResult<char> {
-        if (!input.empty() && !std::isspace(static_cast<unsigned char>(input[0]))) {
-            return ParseSuccess<char>{input[0], input.substr(1)};
+int main(int argc, char** argv) {
+    // --image FILE starts from a SAVE-IMAGE file instead of an empty
+    // interpreter, --prelude FILE loads a library first, --cache DIR keeps
+    // compiled scripts, --jobs N runs the scripts in parallel,
+    // --sample FILE samples the whole run and writes its folded stacks, and
+    // --perf-counters profiles every word with hardware counters and
+    // prints the profile at exit
+    std::string image;
+    std::string prelude;
+    std::string cache;
+    std::string sample;
+    bool perf_counters = false;
+    unsigned workers = 0;
+    int arg = 1;
+    for (; arg < argc && std::string_view(argv[arg]).starts_with("--"); ++arg) {
+        std::string_view option = argv[arg];
+        if (option == "--perf-counters") {
+            perf_counters = true;
+            continue;
+        }
+        if (arg + 1 >= argc) {
+            print_usage();
+            return 2;
         }
-        return "Expected non-whitespace character.";
-    }));
-
-    // Parse the line into words
-    auto split_parser = sep_by(map(word_parser, [](const std::vector<char>& chars) {
-        return std::string(chars.begin(), chars.end());
-    }), whitespace);
-
-    auto result = split_parser(line);
-    if (std::holds_alternative<ParseSuccess<std::vector<std::string>>>(result)) {
-        auto success = std::get<ParseSuccess<std::vector<std::string>>>(result);
-
-        for (const auto& word : success.value) {
-            try {
-                // Try to convert to an integer and push it onto the stack
-                int value = std::stoi(word);
-                push(value);
-            } catch (const std::invalid_argument&) {
-                // If it's not an integer, treat it as a command
-                execute_word(word);
+        std::string_view value = argv[++arg];
+        if (option == "--image") {
+            image = value;
+        } else if (option == "--prelude") {
+            prelude = value;
+        } else if (option == "--cache") {
+            cache = value;
+        } else if (option == "--sample") {
+            sample = value;
+        } else if (option == "--jobs") {
+            if (std::from_chars(value.data(), value.data() + value.size(), workers).ec != std::errc{} || workers == 0) {
+                print_usage();
+                return 2;
             }
+        } else {
+            print_usage();
+            return 2;
         }
-    } else {
-        std::cout << ANSIColor::apply("Parse error: ", ANSIColor::RED) << std::get<std::string>(result) << std::endl;
     }
-}
-
-} // namespace cbasic
-
-// Startup Banner
-void print_startup_banner() {
-    std::cout << ANSIColor::apply("========================================", ANSIColor::CYAN) << std::endl;
-    std::cout << ANSIColor::apply("        WELCOME TO CBASIC REPL", ANSIColor::GREEN) << std::endl;
-    std::cout << ANSIColor::apply("        A Very Cool Experience", ANSIColor::MAGENTA) << std::endl;
-    std::cout << ANSIColor::apply("========================================", ANSIColor::CYAN) << std::endl;
-    std::cout << ANSIColor::apply("Type 'EXIT' to quit or 'PRINT' to see the stack.", ANSIColor::YELLOW) << std::endl;
-    std::cout << std::endl;
-}
-
-int main() {
-    using namespace cbasic;
+    std::vector<std::string> scripts(argv + arg, argv + argc);
+
+    // The interpreter buffers its own output; batch runs need not keep
+    // std::cout in step with stdio. Decided before anything is written, as
+    // sync_with_stdio() must be called before any I/O.
+    const bool interactive = workers == 0 && scripts.empty() && isatty(STDIN_FILENO);
+    if (!interactive) {
+        std::ios::sync_with_stdio(false);
+    }
 
-    // Initialize the CBASIC environment
-    register_command_case_insensitive(environment, "PRINT", print_stack);
-    register_command_case_insensitive(environment, "ADD", add);
-    register_command_case_insensitive(environment, "SUB", subtract);
-    alias(environment, "PRINT", "P");
-    alias(environment, "ADD", "+");
-    alias(environment, "SUB", "-");
+    if (workers > 0) {
+        if (!sample.empty() || perf_counters) {
+            print_usage();
+            return 2;
+        }
+        return run_scripts(workers, image, prelude, cache, scripts);
+    }
 
+    cbasic::Interpreter interpreter;
+    if (!sample.empty()) {
+        interpreter.sample(cbasic::ProfileCommand::On);
+    }
+    if (perf_counters && !interpreter.perf_counters()) {
+        std::cerr << "cbasic: hardware counters unavailable (" << interpreter.counters().reason()
+                  << "); profiling times only" << std::endl;
+    }
+    auto finish = [&](int status) {
+        if (!sample.empty()) {
+            interpreter.sample(cbasic::ProfileCommand::Off);
+            interpreter.sample(cbasic::ProfileCommand::Folded, sample);
+        }
+        if (perf_counters) {
+            interpreter.profile(cbasic::ProfileCommand::Report);
+            interpreter.flush();
+        }
+        return status;
+    };
+    if (!image.empty() && !interpreter.load_image(image)) {
+        return finish(1);
+    }
+    if (!prelude.empty()) {
+        std::string text;
+        if (!read_file(prelude, text) || !interpreter.load_library(std::move(text))) {
+            return finish(1);
+        }
+    }
 
-    print_startup_banner();
+    if (!scripts.empty()) {
+        return finish(run_batch(interpreter, cache, scripts));
+    }
+    if (!interactive) {
+        // Input piped in rather than typed: no prompts or colors
+        return finish(cbasic::run_input(interpreter, std::cin) ? 0 : 1);
+    }
 
+    interpreter.set_color(true);
+    cbasic::OutputSink& out = interpreter.out();
+    print_startup_banner(out);
 
     std::string line;
-    while (true) {
-        std::cout << ANSIColor::apply("CBASIC> ", ANSIColor::BLUE) << std::flush;
-        std::getline(std::cin, line);
+    for (std::uint32_t number = 1;; ++number) {
+        out.paint<cbasic::Color::Blue>("CBASIC> ");
+        out.flush();
+        if (!std::getline(std::cin, line)) {
+            out << '\n';  // end of input (Ctrl-D)
+            break;
+        }
 
-        if (line == "EXIT") {
-            std::cout << ANSIColor::apply("Goodbye!", ANSIColor::GREEN) << std::endl;
+        if (cnomlite::iequals(line, "EXIT")) {
+            out.paint<cbasic::Color::Green>("Goodbye!") << '\n';
             break;
         }
 
-        execute_line(line);
+        // Numbered as lines of the session, for SAMPLE
+        interpreter.run(interpreter.compile(line), number);
     }
 
-    return 0;
-}
-
-void register_command_case_insensitive(
-    std::unordered_map<std::string, std::function<void()>>& map,
-    const std::string& name,
-    const std::function<void()>& command)
-{
-    // Add the original (assume it's case-sensitive by default)
-    map[name] = command;
-
-    // Add the lowercase version
-    std::string lowercase_name = name;
-    std::transform(lowercase_name.begin(), lowercase_name.end(), lowercase_name.begin(), ::tolower);
-    map[lowercase_name] = command;
-
-    // Add the uppercase version
-    std::string uppercase_name = name;
-    std::transform(uppercase_name.begin(), uppercase_name.end(), uppercase_name.begin(), ::toupper);
-    map[uppercase_name] = command;
-}
-
-// Alias Function
-void alias(std::unordered_map<std::string, std::function<void()>>& map, const char* existing, const char* alias_name) {
-    std::string existing_str(existing);
-    std::string alias_str(alias_name);
-    if (map.find(existing_str) != map.end()) {
-        map[alias_str] = map[existing_str];
-    } else {
-        std::cout << ANSIColor::apply("Error: Unknown command '" + existing_str + "'", ANSIColor::RED) << std::endl;
-    }
+    return finish(0);
 }
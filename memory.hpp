@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define CBASIC_HEAP_MMAP 1
+#endif
+
+#if defined(__linux__)
+#define CBASIC_HEAP_MEMFD 1
+#endif
+
+namespace cbasic {
+
+class HeapImage;
+
+// -----------------------------
+// Heap
+// -----------------------------
+// CBASIC's linear memory: one contiguous arena addressed by byte offsets
+// from 0 to HERE. The whole capacity is reserved up front, so the arena never
+// moves and offsets stay valid; pages are only committed when first touched
+// and start out zeroed. On Linux the arena is 2 MiB aligned and advised for
+// transparent huge pages, which cuts TLB misses on large data sets.
+//
+// A heap can also be restored from a HeapImage, a frozen copy of another
+// heap. On Linux the image is a memory file mapped copy-on-write, so a
+// restore costs a few system calls and pages are only copied when written.
+//
+// Access is split into an explicit bounds check (in_bounds) and unchecked
+// load/store, so a compiler can check a whole range once and then access it
+// freely, e.g. outside a loop instead of on every iteration.
+class Heap {
+public:
+    static constexpr std::size_t HUGE_PAGE = std::size_t{2} << 20;
+#if CBASIC_HEAP_MMAP
+    static constexpr std::size_t DEFAULT_CAPACITY = std::size_t{1} << 34;  // address space, not memory
+#else
+    static constexpr std::size_t DEFAULT_CAPACITY = std::size_t{64} << 20;
+#endif
+
+    explicit Heap(std::size_t capacity = DEFAULT_CAPACITY) : capacity_(capacity) {
+#if CBASIC_HEAP_MMAP
+        mapping_size_ = capacity_ + HUGE_PAGE;
+        void* p = mmap(nullptr, mapping_size_, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        mapping_ = static_cast<std::byte*>(p);
+        auto aligned = (reinterpret_cast<std::uintptr_t>(mapping_) + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+        base_ = reinterpret_cast<std::byte*>(aligned);
+        advise_huge_pages(0);
+#else
+        base_ = static_cast<std::byte*>(std::calloc(capacity_, 1));
+        if (!base_) {
+            throw std::bad_alloc();
+        }
+#endif
+    }
+
+    ~Heap() {
+#if CBASIC_HEAP_MMAP
+        munmap(mapping_, mapping_size_);
+#else
+        std::free(base_);
+#endif
+    }
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    std::uint64_t here() const { return here_; }
+    std::size_t capacity() const { return capacity_; }
+    std::byte* data() { return base_; }
+    const std::byte* data() const { return base_; }
+
+    // Move HERE by n bytes (negative n releases). False if out of range.
+    bool allot(std::int64_t n) {
+        if (n < 0 ? static_cast<std::uint64_t>(-n) > here_
+                  : static_cast<std::uint64_t>(n) > capacity_ - here_) {
+            return false;
+        }
+        here_ += static_cast<std::uint64_t>(n);
+        high_ = std::max(high_, here_);
+        return true;
+    }
+
+    // Release everything: HERE goes back to 0 and the memory reads as zero
+    // again, including memory released by a negative ALLOT. On Linux the
+    // pages are handed back rather than cleared.
+    void clear() {
+#if CBASIC_HEAP_MEMFD
+        // Dropping a page of a mapped image would bring back the image's
+        // contents, so those pages are replaced with fresh anonymous memory
+        if (image_bytes_ > 0) {
+            map_anonymous(0, image_bytes_);
+            image_bytes_ = 0;
+        }
+        madvise(base_, high_, MADV_DONTNEED);
+#else
+        std::memset(base_, 0, high_);
+#endif
+        here_ = 0;
+        high_ = 0;
+    }
+
+    // Replace the contents with a copy of `image`, including its HERE
+    inline void restore(const HeapImage& image);
+
+    // [addr, addr + width) lies inside the allotted memory
+    bool in_bounds(std::uint64_t addr, std::uint64_t width) const {
+        return addr <= here_ && width <= here_ - addr;
+    }
+
+    template <typename T>
+    T load(std::uint64_t addr) const {
+        T value;
+        std::memcpy(&value, base_ + addr, sizeof value);
+        return value;
+    }
+
+    template <typename T>
+    void store(std::uint64_t addr, T value) {
+        std::memcpy(base_ + addr, &value, sizeof value);
+    }
+
+private:
+#if CBASIC_HEAP_MMAP
+    // Transparent huge pages for the anonymous part of the arena
+    void advise_huge_pages([[maybe_unused]] std::size_t from) {
+#ifdef MADV_HUGEPAGE
+        madvise(base_ + from, capacity_ - from, MADV_HUGEPAGE);
+#endif
+    }
+#endif
+
+#if CBASIC_HEAP_MEMFD
+    void map_anonymous(std::size_t from, std::size_t bytes) {
+        if (mmap(base_ + from, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+    }
+
+    std::size_t image_bytes_ = 0;  // bytes from 0 mapped from a HeapImage
+#endif
+
+    std::size_t capacity_;
+    std::byte* base_ = nullptr;
+#if CBASIC_HEAP_MMAP
+    std::byte* mapping_ = nullptr;
+    std::size_t mapping_size_ = 0;
+#endif
+    std::uint64_t here_ = 0;
+    std::uint64_t high_ = 0;  // the highest HERE since the last clear or restore: what may have been written
+};
+
+// A frozen copy of a heap's memory up to HERE, which any number of heaps can
+// restore from. On Linux it lives in an anonymous memory file: taking one
+// copies the heap once, and heaps map it privately, so they share its pages
+// until they write to them. An image can also be a region of a file on disk,
+// such as the heap section of a SAVE-IMAGE file, which is mapped the same way.
+class HeapImage {
+public:
+    explicit HeapImage(const Heap& heap) : here_(heap.here()) {
+#if CBASIC_HEAP_MEMFD
+        const auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        bytes_ = (here_ + page - 1) & ~(page - 1);
+        if (bytes_ == 0) {
+            return;
+        }
+        fd_ = memfd_create("cbasic-heap", MFD_CLOEXEC);
+        if (fd_ < 0 || ftruncate(fd_, static_cast<off_t>(bytes_)) != 0) {
+            throw std::bad_alloc();
+        }
+        for (std::size_t done = 0; done < here_;) {
+            ssize_t n = pwrite(fd_, heap.data() + done, here_ - done, static_cast<off_t>(done));
+            if (n <= 0) {
+                throw std::bad_alloc();
+            }
+            done += static_cast<std::size_t>(n);
+        }
+#else
+        bytes_.assign(heap.data(), heap.data() + here_);
+#endif
+    }
+
+#if CBASIC_HEAP_MMAP
+    // `here` bytes of the open file `fd` from `offset`, which must be a
+    // multiple of the page size; the file must extend to a whole page past
+    // them. The image keeps its own descriptor.
+    HeapImage(int fd, std::uint64_t offset, std::uint64_t here) : here_(here) {
+#if CBASIC_HEAP_MEMFD
+        const auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        bytes_ = (here_ + page - 1) & ~(page - 1);
+        offset_ = offset;
+        if (bytes_ > 0 && (fd_ = dup(fd)) < 0) {
+            throw std::bad_alloc();
+        }
+#else
+        bytes_.resize(here_);
+        for (std::size_t done = 0; done < here_;) {
+            ssize_t n = pread(fd, bytes_.data() + done, here_ - done, static_cast<off_t>(offset + done));
+            if (n <= 0) {
+                throw std::bad_alloc();
+            }
+            done += static_cast<std::size_t>(n);
+        }
+#endif
+    }
+#endif
+
+    ~HeapImage() {
+#if CBASIC_HEAP_MEMFD
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+#endif
+    }
+
+    HeapImage(const HeapImage&) = delete;
+    HeapImage& operator=(const HeapImage&) = delete;
+
+    std::uint64_t here() const { return here_; }
+
+private:
+    friend class Heap;
+
+    std::uint64_t here_;
+#if CBASIC_HEAP_MEMFD
+    int fd_ = -1;
+    std::uint64_t offset_ = 0;
+    std::size_t bytes_ = 0;  // here_ rounded up to whole pages
+#else
+    std::vector<std::byte> bytes_;
+#endif
+};
+
+inline void Heap::restore(const HeapImage& image) {
+#if CBASIC_HEAP_MEMFD
+    // One fresh mapping over what this heap used, then the image on top
+    const std::size_t used = std::max<std::size_t>(image_bytes_, high_);
+    if (used > 0) {
+        map_anonymous(0, std::min(capacity_, (used + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1)));
+    }
+    if (image.bytes_ > 0 &&
+        mmap(base_, image.bytes_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, image.fd_,
+             static_cast<off_t>(image.offset_)) == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    image_bytes_ = image.bytes_;
+    advise_huge_pages(image_bytes_);
+#else
+    std::memset(base_, 0, high_);
+    std::memcpy(base_, image.bytes_.data(), image.bytes_.size());
+#endif
+    here_ = image.here_;
+    high_ = image.here_;
+}
+
+// An array: `length` 8-byte elements (doubles, or int64 for NAME% arrays)
+// stored contiguously at `offset`, in the heap for DIM arrays or in the
+// scratch arena for temporaries produced by array words
+struct Array {
+    std::uint64_t offset = 0;
+    std::uint64_t length = 0;
+    bool integer = false;
+    bool temporary = false;
+};
+
+} // namespace cbasic
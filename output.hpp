@@ -0,0 +1,127 @@
+#pragma once
+
+#include "value.hpp"
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string_view>
+
+namespace cbasic {
+
+// -----------------------------
+// Output
+// -----------------------------
+// Everything an interpreter prints goes through an OutputSink: a fixed
+// buffer in front of a std::ostream, filled with string views and
+// to_chars-formatted numbers. Printing allocates nothing, and reaches the
+// stream only when the buffer fills or the owner flushes it: before a REPL
+// prompt, after a job, at exit. Colors are escape sequences fixed at compile
+// time, and nothing at all is written for them while color is off.
+
+enum class Color : std::uint8_t { Red, Green, Yellow, Blue, Magenta, Cyan };
+
+constexpr std::string_view escape(Color color) {
+    switch (color) {
+        case Color::Red: return "\033[31m";
+        case Color::Green: return "\033[32m";
+        case Color::Yellow: return "\033[33m";
+        case Color::Blue: return "\033[34m";
+        case Color::Magenta: return "\033[35m";
+        case Color::Cyan: return "\033[36m";
+    }
+    return {};
+}
+
+inline constexpr std::string_view RESET_ESCAPE = "\033[0m";
+
+class OutputSink {
+public:
+    static constexpr std::size_t CAPACITY = std::size_t{64} << 10;
+
+    explicit OutputSink(std::ostream& out) : out_(out), buffer_(std::make_unique<char[]>(CAPACITY)) {}
+
+    ~OutputSink() { flush(); }
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    void set_color(bool color) { color_ = color; }
+    bool color() const { return color_; }
+
+    OutputSink& operator<<(std::string_view text) {
+        write(text.data(), text.size());
+        return *this;
+    }
+
+    OutputSink& operator<<(char c) {
+        if (size_ == CAPACITY) {
+            drain();
+        }
+        buffer_[size_++] = c;
+        return *this;
+    }
+
+    OutputSink& operator<<(Value v) {
+        char text[32];
+        return *this << v.format(text);
+    }
+
+    OutputSink& operator<<(double x) { return *this << Value::real(x); }
+
+    template <std::integral T>
+    OutputSink& operator<<(T n) {
+        char text[24];
+        auto r = std::to_chars(text, text + sizeof text, n);
+        write(text, static_cast<std::size_t>(r.ptr - text));
+        return *this;
+    }
+
+    // `text` in color C, if color is on
+    template <Color C>
+    OutputSink& paint(std::string_view text) {
+        if (color_) {
+            constexpr std::string_view on = escape(C);
+            write(on.data(), on.size());
+            write(text.data(), text.size());
+            write(RESET_ESCAPE.data(), RESET_ESCAPE.size());
+        } else {
+            write(text.data(), text.size());
+        }
+        return *this;
+    }
+
+    // Hand everything buffered to the stream and flush it
+    void flush() {
+        drain();
+        out_.flush();
+    }
+
+private:
+    void write(const char* text, std::size_t n) {
+        if (n > CAPACITY - size_) {
+            drain();
+            if (n >= CAPACITY) {
+                out_.write(text, static_cast<std::streamsize>(n));
+                return;
+            }
+        }
+        std::memcpy(buffer_.get() + size_, text, n);
+        size_ += n;
+    }
+
+    void drain() {
+        out_.write(buffer_.get(), static_cast<std::streamsize>(size_));
+        size_ = 0;
+    }
+
+    std::ostream& out_;
+    std::unique_ptr<char[]> buffer_;
+    std::size_t size_ = 0;
+    bool color_ = false;
+};
+
+} // namespace cbasic
@@ -0,0 +1,119 @@
+#include "perf.hpp"
+#include <cstdio>
+
+#if defined(__linux__)
+#define CBASIC_PERF_EVENTS 1
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace cbasic {
+
+bool PerfCounters::open() {
+    if (available() && owner_ == std::this_thread::get_id()) {
+        return true;
+    }
+    close();
+    if (!reason_.empty()) {
+        return false;
+    }
+#ifdef CBASIC_PERF_EVENTS
+    static constexpr std::array<std::uint64_t, PERF_EVENTS> configs{
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    int error = 0;
+    for (std::size_t i = 0; i < PERF_EVENTS; ++i) {
+        perf_event_attr attr{};
+        attr.size = sizeof attr;
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        const long fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0);
+        if (fd < 0) {
+            error = errno;
+            continue;
+        }
+        fds_[i] = static_cast<int>(fd);
+        slots_[i] = static_cast<int>(members_++);
+        if (leader_ < 0) {
+            leader_ = fds_[i];
+        }
+    }
+    if (!available()) {
+        reason_ = std::string("perf_event_open: ") + std::strerror(error);
+        return false;
+    }
+    owner_ = std::this_thread::get_id();
+    return true;
+#else
+    reason_ = "hardware counters need Linux perf_event_open";
+    return false;
+#endif
+}
+
+void PerfCounters::close() {
+#ifdef CBASIC_PERF_EVENTS
+    for (int& fd : fds_) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        fd = -1;
+    }
+#endif
+    slots_.fill(-1);
+    leader_ = -1;
+    members_ = 0;
+}
+
+PerfCounts PerfCounters::read() const {
+    PerfCounts counts;
+#ifdef CBASIC_PERF_EVENTS
+    if (!available()) {
+        return counts;
+    }
+    // { nr, time_enabled, time_running, value[nr] }
+    std::uint64_t data[3 + PERF_EVENTS];
+    const ssize_t size = ::read(leader_, data, sizeof data);
+    if (size < static_cast<ssize_t>((3 + members_) * sizeof(std::uint64_t)) || data[2] == 0) {
+        return counts;
+    }
+    const double scale = static_cast<double>(data[1]) / static_cast<double>(data[2]);
+    for (std::size_t i = 0; i < PERF_EVENTS; ++i) {
+        if (slots_[i] >= 0) {
+            const std::uint64_t value = data[3 + slots_[i]];
+            counts.events[i] = data[1] == data[2] ? value : static_cast<std::uint64_t>(static_cast<double>(value) * scale);
+        }
+    }
+#endif
+    return counts;
+}
+
+void PerfCounters::print(OutputSink& out, const PerfCounts& counts) const {
+    const double instructions = static_cast<double>(counts[PerfEvent::Instructions]);
+    char text[64];
+    bool first = true;
+    for (const auto& [event, name] : PERF_EVENT_NAMES) {
+        if (!has(event)) {
+            continue;
+        }
+        out << (first ? "" : ", ") << counts[event] << ' ' << name;
+        first = false;
+        if (event == PerfEvent::Instructions && has(PerfEvent::Cycles) && counts[PerfEvent::Cycles] > 0) {
+            std::snprintf(text, sizeof text, " (%.2f IPC)",
+                          instructions / static_cast<double>(counts[PerfEvent::Cycles]));
+            out << std::string_view(text);
+        } else if ((event == PerfEvent::CacheMisses || event == PerfEvent::BranchMisses) &&
+                   has(PerfEvent::Instructions) && instructions > 0) {
+            std::snprintf(text, sizeof text, " (%.2f per 1000 instructions)",
+                          1000.0 * static_cast<double>(counts[event]) / instructions);
+            out << std::string_view(text);
+        }
+    }
+}
+
+} // namespace cbasic
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "output.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+namespace cbasic {
+
+// -----------------------------
+// Hardware performance counters
+// -----------------------------
+// On Linux, perf_event_open counts four events for the calling thread:
+//   - CPU cycles;
+//   - instructions retired;
+//   - last-level cache misses;
+//   - mispredicted branches.
+// The counts are for user space only, so the read() that takes them is not
+// counted. The events form one group and are read with a single read(). If
+// the kernel shares the PMU with other users and schedules the group only
+// part of the time, the counts are scaled up to the whole time.
+//
+// Counters are often unavailable, for example in containers, in VMs without
+// a virtual PMU, or with kernel.perf_event_paranoid above 2. Then open()
+// fails and reason() says why, and callers report times only. An event
+// that the CPU lacks is left out and reads as zero.
+
+enum class PerfEvent : std::uint8_t { Cycles, Instructions, CacheMisses, BranchMisses };
+
+inline constexpr std::size_t PERF_EVENTS = 4;
+
+inline constexpr std::array<std::pair<PerfEvent, std::string_view>, PERF_EVENTS> PERF_EVENT_NAMES{{
+    {PerfEvent::Cycles, "cycles"}, {PerfEvent::Instructions, "instructions"},
+    {PerfEvent::CacheMisses, "cache misses"}, {PerfEvent::BranchMisses, "branch misses"},
+}};
+
+struct PerfCounts {
+    std::array<std::uint64_t, PERF_EVENTS> events{};
+
+    std::uint64_t operator[](PerfEvent event) const { return events[static_cast<std::size_t>(event)]; }
+
+    PerfCounts& operator+=(const PerfCounts& other) {
+        for (std::size_t i = 0; i < PERF_EVENTS; ++i) {
+            events[i] += other.events[i];
+        }
+        return *this;
+    }
+
+    // Counts are monotonic, but scaling can make a later read come out lower
+    PerfCounts operator-(const PerfCounts& earlier) const {
+        PerfCounts delta;
+        for (std::size_t i = 0; i < PERF_EVENTS; ++i) {
+            delta.events[i] = events[i] > earlier.events[i] ? events[i] - earlier.events[i] : 0;
+        }
+        return delta;
+    }
+};
+
+class PerfCounters {
+public:
+    PerfCounters() = default;
+    ~PerfCounters() { close(); }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // Count for the calling thread. Counters open on another thread are
+    // closed and opened again here. False, with reason(), if no event can
+    // be counted; a failure is remembered and not retried.
+    bool open();
+    void close();
+
+    bool available() const { return leader_ >= 0; }
+    bool has(PerfEvent event) const { return slots_[static_cast<std::size_t>(event)] >= 0; }
+    const std::string& reason() const { return reason_; }
+
+    // The counts since open(); all zero if not available
+    PerfCounts read() const;
+
+    // "N cycles, N instructions (x IPC), ..." for the events counted, with
+    // misses per thousand instructions
+    void print(OutputSink& out, const PerfCounts& counts) const;
+
+private:
+    int leader_ = -1;
+    std::array<int, PERF_EVENTS> fds_{-1, -1, -1, -1};
+    std::array<int, PERF_EVENTS> slots_{-1, -1, -1, -1};  // position in the group's read, -1: not counted
+    std::size_t members_ = 0;
+    std::thread::id owner_;
+    std::string reason_;
+};
+
+} // namespace cbasic
@@ -0,0 +1,276 @@
+#pragma once
+
+#include "cnomlite.hpp"
+#include "kernels.hpp"
+#include "value.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cbasic {
+
+// -----------------------------
+// Array pipelines
+// -----------------------------
+// Arithmetic on arrays, MAP, FILTER and ZIP compute nothing: each adds a node
+// to an expression graph and pushes a reference to it. A terminal word
+// (REDUCE, ASUM, AMAX, ADOT, TO) then evaluates the graph in a single pass,
+// BLOCK elements at a time, so every intermediate block stays in L1 and
+// `A 2 * B + ASUM` reads A and B once instead of making four passes over
+// memory through full-size temporaries.
+
+enum class MapFn : std::uint8_t { Abs, Negate, Sqrt, Square };
+enum class ZipFn : std::uint8_t { Add, Sub, Mul, Max, Min };
+enum class Compare : std::uint8_t { Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual };
+
+// Function names accepted after MAP, ZIP/REDUCE and FILTER
+inline constexpr std::array<std::pair<std::string_view, MapFn>, 4> MAP_FNS{{
+    {"ABS", MapFn::Abs}, {"NEGATE", MapFn::Negate}, {"SQRT", MapFn::Sqrt}, {"SQUARE", MapFn::Square},
+}};
+inline constexpr std::array<std::pair<std::string_view, ZipFn>, 8> ZIP_FNS{{
+    {"+", ZipFn::Add}, {"ADD", ZipFn::Add}, {"-", ZipFn::Sub}, {"SUB", ZipFn::Sub},
+    {"*", ZipFn::Mul}, {"MUL", ZipFn::Mul}, {"MAX", ZipFn::Max}, {"MIN", ZipFn::Min},
+}};
+inline constexpr std::array<std::pair<std::string_view, Compare>, 6> COMPARES{{
+    {"<", Compare::Less}, {"<=", Compare::LessEqual}, {">", Compare::Greater},
+    {">=", Compare::GreaterEqual}, {"=", Compare::Equal}, {"<>", Compare::NotEqual},
+}};
+
+template <typename E, std::size_t N>
+std::optional<E> lookup_fn(const std::array<std::pair<std::string_view, E>, N>& table, std::string_view word) {
+    for (const auto& [name, fn] : table) {
+        if (cnomlite::iequals(name, word)) {
+            return fn;
+        }
+    }
+    return std::nullopt;
+}
+
+struct ExprNode {
+    enum class Kind : std::uint8_t { Source, Scalar, Map, Zip, Filter };
+
+    Kind kind = Kind::Scalar;
+    std::uint8_t fn = 0;        // MapFn, ZipFn or Compare
+    bool integer = false;       // int64 elements, else double
+    bool filtered = false;      // the length is only an upper bound
+    std::uint32_t lhs = 0;      // operand nodes; Source: the array number
+    std::uint32_t rhs = 0;
+    std::uint64_t length = 0;   // elements (0 for scalars)
+    Value scalar{};             // Scalar: the value; Filter: the threshold
+};
+
+class ExprGraph {
+public:
+    // Elements per block: a few blocks of doubles fit in a 32 KiB L1
+    static constexpr std::size_t BLOCK = 1024;
+
+    std::uint32_t add(const ExprNode& node) {
+        nodes_.push_back(node);
+        return static_cast<std::uint32_t>(nodes_.size() - 1);
+    }
+
+    const ExprNode& operator[](std::uint32_t id) const { return nodes_[id]; }
+    std::size_t size() const { return nodes_.size(); }
+    void clear() { nodes_.clear(); }
+
+    // Call f(array, length) for each source of `root`; false if any f is false
+    template <typename F>
+    bool all_sources(std::uint32_t root, F f) const {
+        for (std::uint32_t id : schedule(root)) {
+            const ExprNode& node = nodes_[id];
+            if (node.kind == ExprNode::Kind::Source && !f(node.lhs, node.length)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Evaluate `root` with element type T. `source(array, start, n, buffer)`
+    // returns n elements of an array from `start` as T (converting into
+    // `buffer`, which holds BLOCK elements, if it has to); `sink(data, count)`
+    // receives the results block by block.
+    template <typename T, typename Source, typename Sink>
+    void evaluate(std::uint32_t root, Source source, Sink sink) const {
+        const std::vector<std::uint32_t> order = schedule(root);
+        std::vector<std::uint32_t> slot(nodes_.size());
+        for (std::size_t k = 0; k < order.size(); ++k) {
+            slot[order[k]] = static_cast<std::uint32_t>(k);
+        }
+        std::vector<T> buffers(order.size() * BLOCK);
+        std::vector<const T*> data(order.size());
+        std::vector<std::size_t> counts(order.size());
+
+        const std::uint64_t length = nodes_[root].length;
+        for (std::uint64_t start = 0; start < length; start += BLOCK) {
+            const std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(BLOCK, length - start));
+            for (std::size_t k = 0; k < order.size(); ++k) {
+                const ExprNode& node = nodes_[order[k]];
+                T* out = buffers.data() + k * BLOCK;
+                switch (node.kind) {
+                    case ExprNode::Kind::Source:
+                        data[k] = source(node.lhs, start, n, out);
+                        counts[k] = n;
+                        continue;
+                    case ExprNode::Kind::Scalar:
+                        continue;  // never scheduled; read by its users
+                    case ExprNode::Kind::Map: {
+                        const std::uint32_t a = slot[node.lhs];
+                        counts[k] = counts[a];
+                        map_block(static_cast<MapFn>(node.fn), data[a], out, counts[k]);
+                        break;
+                    }
+                    case ExprNode::Kind::Zip: {
+                        const ExprNode& l = nodes_[node.lhs];
+                        const ExprNode& r = nodes_[node.rhs];
+                        const auto fn = static_cast<ZipFn>(node.fn);
+                        if (l.kind == ExprNode::Kind::Scalar) {
+                            const std::uint32_t b = slot[node.rhs];
+                            counts[k] = counts[b];
+                            scalar_zip_block(fn, element<T>(l.scalar), data[b], out, counts[k]);
+                        } else if (r.kind == ExprNode::Kind::Scalar) {
+                            const std::uint32_t a = slot[node.lhs];
+                            counts[k] = counts[a];
+                            zip_scalar_block(fn, data[a], element<T>(r.scalar), out, counts[k]);
+                        } else {
+                            const std::uint32_t a = slot[node.lhs];
+                            counts[k] = counts[a];
+                            zip_block(fn, data[a], data[slot[node.rhs]], out, counts[k]);
+                        }
+                        break;
+                    }
+                    case ExprNode::Kind::Filter: {
+                        const std::uint32_t a = slot[node.lhs];
+                        counts[k] = filter_block(static_cast<Compare>(node.fn), data[a], element<T>(node.scalar), out, counts[a]);
+                        break;
+                    }
+                }
+                data[k] = out;
+            }
+            sink(data.back(), counts.back());
+        }
+    }
+
+private:
+    // The stream nodes `root` depends on, operands before their users, each
+    // once even when shared (`A A *`); scalars are left out
+    std::vector<std::uint32_t> schedule(std::uint32_t root) const {
+        std::vector<std::uint32_t> order;
+        std::vector<bool> seen(nodes_.size());
+        visit(root, order, seen);
+        return order;
+    }
+
+    void visit(std::uint32_t id, std::vector<std::uint32_t>& order, std::vector<bool>& seen) const {
+        const ExprNode& node = nodes_[id];
+        if (seen[id] || node.kind == ExprNode::Kind::Scalar) {
+            return;
+        }
+        seen[id] = true;
+        if (node.kind != ExprNode::Kind::Source) {
+            visit(node.lhs, order, seen);
+            if (node.kind == ExprNode::Kind::Zip) {
+                visit(node.rhs, order, seen);
+            }
+        }
+        order.push_back(id);
+    }
+
+    template <typename T>
+    static T element(Value v) {
+        if constexpr (std::is_integral_v<T>) {
+            return v.to_int();
+        } else {
+            return v.to_double();
+        }
+    }
+
+    template <typename T>
+    static void map_block(MapFn fn, const T* a, T* out, std::size_t n) {
+        switch (fn) {
+            case MapFn::Abs:
+                for (std::size_t i = 0; i < n; ++i) out[i] = a[i] < 0 ? -a[i] : a[i];
+                break;
+            case MapFn::Negate:
+                for (std::size_t i = 0; i < n; ++i) out[i] = -a[i];
+                break;
+            case MapFn::Sqrt:
+                for (std::size_t i = 0; i < n; ++i) out[i] = static_cast<T>(std::sqrt(a[i]));
+                break;
+            case MapFn::Square:
+                kernels::mul(a, a, out, n);
+                break;
+        }
+    }
+
+    template <typename T>
+    static void zip_block(ZipFn fn, const T* a, const T* b, T* out, std::size_t n) {
+        switch (fn) {
+            case ZipFn::Add: kernels::add(a, b, out, n); break;
+            case ZipFn::Sub: kernels::sub(a, b, out, n); break;
+            case ZipFn::Mul: kernels::mul(a, b, out, n); break;
+            case ZipFn::Max:
+                for (std::size_t i = 0; i < n; ++i) out[i] = a[i] > b[i] ? a[i] : b[i];
+                break;
+            case ZipFn::Min:
+                for (std::size_t i = 0; i < n; ++i) out[i] = a[i] < b[i] ? a[i] : b[i];
+                break;
+        }
+    }
+
+    template <typename T>
+    static void zip_scalar_block(ZipFn fn, const T* a, T s, T* out, std::size_t n) {
+        switch (fn) {
+            case ZipFn::Add: kernels::add(a, s, out, n); break;
+            case ZipFn::Sub: kernels::sub(a, s, out, n); break;
+            case ZipFn::Mul: kernels::mul(a, s, out, n); break;
+            case ZipFn::Max:
+                for (std::size_t i = 0; i < n; ++i) out[i] = a[i] > s ? a[i] : s;
+                break;
+            case ZipFn::Min:
+                for (std::size_t i = 0; i < n; ++i) out[i] = a[i] < s ? a[i] : s;
+                break;
+        }
+    }
+
+    // s op b: only subtraction is not commutative
+    template <typename T>
+    static void scalar_zip_block(ZipFn fn, T s, const T* b, T* out, std::size_t n) {
+        if (fn == ZipFn::Sub) {
+            for (std::size_t i = 0; i < n; ++i) out[i] = s - b[i];
+        } else {
+            zip_scalar_block(fn, b, s, out, n);
+        }
+    }
+
+    // Compact the elements of `a` that pass `cmp t`; returns how many did
+    template <typename T>
+    static std::size_t filter_block(Compare cmp, const T* a, T t, T* out, std::size_t n) {
+        auto keep = [&](auto pass) {
+            std::size_t k = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                out[k] = a[i];
+                k += pass(a[i]) ? 1 : 0;
+            }
+            return k;
+        };
+        switch (cmp) {
+            case Compare::Less: return keep([t](T x) { return x < t; });
+            case Compare::LessEqual: return keep([t](T x) { return x <= t; });
+            case Compare::Greater: return keep([t](T x) { return x > t; });
+            case Compare::GreaterEqual: return keep([t](T x) { return x >= t; });
+            case Compare::Equal: return keep([t](T x) { return x == t; });
+            case Compare::NotEqual: return keep([t](T x) { return x != t; });
+        }
+        return 0;
+    }
+
+    std::vector<ExprNode> nodes_;
+};
+
+} // namespace cbasic
@@ -0,0 +1,338 @@
+#include "cbasic.hpp"
+#include <cstdio>
+#include <fstream>
+
+namespace cbasic {
+
+double Profiler::nanoseconds_per_tick() const {
+#ifdef CBASIC_PROFILE_TSC
+    const std::uint64_t elapsed = ticks() - epoch_ticks_;
+    const double ns = std::chrono::duration<double, std::nano>(Clock::now() - epoch_).count();
+    return elapsed > 0 ? ns / static_cast<double>(elapsed) : 0.0;
+#else
+    return std::chrono::duration<double, std::nano>(Clock::duration(1)).count();
+#endif
+}
+
+std::vector<double> Profiler::self_times() const {
+    const double scale = nanoseconds_per_tick();
+    std::vector<double> self(nodes_.size());
+    for (std::uint32_t i = 0; i < nodes_.size(); ++i) {
+        self[i] += static_cast<double>(nodes_[i].ticks) * scale;
+        if (i != ROOT) {
+            self[nodes_[i].parent] -= static_cast<double>(nodes_[i].ticks) * scale;
+        }
+    }
+    // A call still in progress has callee time but no time of its own yet
+    for (double& ns : self) {
+        ns = std::max(ns, 0.0);
+    }
+    return self;
+}
+
+void Profiler::report(OutputSink& out) const {
+    struct Totals {
+        std::string_view name;
+        std::uint64_t calls = 0;
+        double self = 0;  // nanoseconds
+        double total = 0;
+        std::size_t depth = 0;
+    };
+    const double scale = nanoseconds_per_tick();
+    const auto self = self_times();
+    std::vector<Totals> words;
+    std::unordered_map<std::string_view, std::size_t> index;
+    for (std::uint32_t i = ROOT + 1; i < nodes_.size(); ++i) {
+        const Node& node = nodes_[i];
+        if (node.calls == 0) {
+            continue;
+        }
+        auto [it, inserted] = index.try_emplace(node.name, words.size());
+        if (inserted) {
+            words.push_back({node.name});
+        }
+        Totals& word = words[it->second];
+        word.calls += node.calls;
+        word.self += self[i];
+        word.depth = std::max(word.depth, node.depth);
+        // A recursive call's time is already in its outermost call's
+        bool outermost = true;
+        for (std::uint32_t p = node.parent; p != ROOT && outermost; p = nodes_[p].parent) {
+            outermost = nodes_[p].name != node.name;
+        }
+        if (outermost) {
+            word.total += static_cast<double>(node.ticks) * scale;
+        }
+    }
+    std::sort(words.begin(), words.end(), [](const Totals& a, const Totals& b) { return a.self > b.self; });
+
+    char line[160];
+    out.paint<Color::Green>("Profile:") << '\n';
+    std::snprintf(line, sizeof line, "%-24s %10s %12s %12s %6s\n", "word", "calls", "self ms", "total ms", "depth");
+    out << std::string_view(line);
+    for (const Totals& word : words) {
+        std::snprintf(line, sizeof line, "%-24.*s %10llu %12.3f %12.3f %6zu\n",
+                      static_cast<int>(std::min<std::size_t>(word.name.size(), 24)), word.name.data(),
+                      static_cast<unsigned long long>(word.calls), word.self / 1e6, word.total / 1e6, word.depth);
+        out << std::string_view(line);
+    }
+    if (counters_) {
+        report_counts(out);
+    }
+}
+
+void Profiler::report_counts(OutputSink& out) const {
+    if (!counters_->available()) {
+        out << "Counters unavailable (" << counters_->reason() << ")\n";
+        return;
+    }
+    std::vector<PerfCounts> self(nodes_.size());
+    for (std::uint32_t i = ROOT + 1; i < nodes_.size(); ++i) {
+        self[i] += nodes_[i].counts;
+    }
+    for (std::uint32_t i = ROOT + 1; i < nodes_.size(); ++i) {
+        if (nodes_[i].parent != ROOT) {
+            self[nodes_[i].parent] = self[nodes_[i].parent] - nodes_[i].counts;
+        }
+    }
+    std::vector<std::pair<std::string_view, PerfCounts>> words;
+    std::unordered_map<std::string_view, std::size_t> index;
+    for (std::uint32_t i = ROOT + 1; i < nodes_.size(); ++i) {
+        if (nodes_[i].calls == 0) {
+            continue;
+        }
+        auto [it, inserted] = index.try_emplace(nodes_[i].name, words.size());
+        if (inserted) {
+            words.push_back({nodes_[i].name, {}});
+        }
+        words[it->second].second += self[i];
+    }
+    std::sort(words.begin(), words.end(), [](const auto& a, const auto& b) {
+        return a.second[PerfEvent::Cycles] > b.second[PerfEvent::Cycles];
+    });
+
+    // Misses per thousand instructions show whether a word waits on memory
+    // or on mispredicted branches
+    auto per_kilo = [](std::uint64_t n, std::uint64_t per) {
+        return per ? 1000.0 * static_cast<double>(n) / static_cast<double>(per) : 0.0;
+    };
+    char line[160];
+    out.paint<Color::Green>("Counters (self):") << '\n';
+    std::snprintf(line, sizeof line, "%-24s %14s %14s %6s %10s %10s\n", "word", "cycles", "instructions", "IPC",
+                  "cache/ki", "branch/ki");
+    out << std::string_view(line);
+    for (const auto& [name, counts] : words) {
+        const std::uint64_t cycles = counts[PerfEvent::Cycles];
+        const std::uint64_t instructions = counts[PerfEvent::Instructions];
+        std::snprintf(line, sizeof line, "%-24.*s %14llu %14llu %6.2f %10.2f %10.2f\n",
+                      static_cast<int>(std::min<std::size_t>(name.size(), 24)), name.data(),
+                      static_cast<unsigned long long>(cycles), static_cast<unsigned long long>(instructions),
+                      cycles ? static_cast<double>(instructions) / static_cast<double>(cycles) : 0.0,
+                      per_kilo(counts[PerfEvent::CacheMisses], instructions),
+                      per_kilo(counts[PerfEvent::BranchMisses], instructions));
+        out << std::string_view(line);
+    }
+}
+
+bool Profiler::write_folded(const std::string& path) const {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+    const auto self = self_times();
+    std::vector<std::uint32_t> chain;
+    for (std::uint32_t i = ROOT + 1; i < nodes_.size(); ++i) {
+        const auto ns = static_cast<std::uint64_t>(self[i]);
+        if (ns == 0) {
+            continue;
+        }
+        chain.clear();
+        for (std::uint32_t n = i; n != ROOT; n = nodes_[n].parent) {
+            chain.push_back(n);
+        }
+        for (std::size_t k = chain.size(); k-- > 0;) {
+            file << nodes_[chain[k]].name << (k ? ";" : " ");
+        }
+        file << ns << '\n';
+    }
+    return static_cast<bool>(file.flush());
+}
+
+// Builtins are named only by the dictionaries; of several names, the
+// longest is taken, so PRINT rather than its alias P
+std::string Interpreter::word_name(Op op, std::uint32_t arg) {
+    if (op == Op::Exec && !reader_.version().definitions[arg]->name.empty()) {
+        return reader_.version().definitions[arg]->name;
+    }
+    if (op == Op::ExecLocal && definitions_[arg] && !definitions_[arg]->name.empty()) {
+        return definitions_[arg]->name;
+    }
+    const Dictionary& words = op == Op::Call || op == Op::Exec ? reader_.version().words : dictionary_;
+    const std::string* best = nullptr;
+    for (const auto& [name, word] : words) {
+        if (word.op == op && word.arg == arg &&
+            (!best || name.size() > best->size() || (name.size() == best->size() && name < *best))) {
+            best = &name;
+        }
+    }
+    return best ? *best : "word#" + std::to_string(arg);
+}
+
+void Interpreter::profile(ProfileCommand command, const std::string& path) {
+    switch (command) {
+        case ProfileCommand::On:
+            profiler_.set_on(true);
+            break;
+        case ProfileCommand::Off:
+            profiler_.set_on(false);
+            break;
+        case ProfileCommand::Reset:
+            profiler_.reset();
+            break;
+        case ProfileCommand::Report:
+            profiler_.report(out_);
+            break;
+        case ProfileCommand::Folded:
+            if (!profiler_.write_folded(path)) {
+                report("Error: PROFILE FOLDED cannot write " + path + ".");
+            }
+            break;
+    }
+}
+
+void Interpreter::sample(ProfileCommand command, const std::string& path) {
+    switch (command) {
+        case ProfileCommand::On:
+            if (!sampler_.start()) {
+                report("Error: SAMPLE ON: sampling needs SIGPROF, and one interpreter at a time.");
+            }
+            break;
+        case ProfileCommand::Off:
+            sampler_.stop();
+            break;
+        case ProfileCommand::Reset:
+            sampler_.reset();
+            break;
+        case ProfileCommand::Report:
+            sampler_.drain();
+            sampler_.report(out_);
+            break;
+        case ProfileCommand::Folded:
+            sampler_.drain();
+            if (!sampler_.write_folded(path)) {
+                report("Error: SAMPLE FOLDED cannot write " + path + ".");
+            }
+            break;
+    }
+}
+
+// PROFILE and SAMPLE end with the script that turned them on (reset,
+// restore), and what they collected is dropped with its words
+void Interpreter::stop_profiling() {
+    profiler_.set_on(false);
+    profiler_.reset();
+    profiler_.forget_words();
+    sampler_.stop();
+    sampler_.reset();
+}
+
+bool Interpreter::perf_counters() {
+    profiler_.set_counters(&perf_);
+    profiler_.set_on(true);
+    return perf_.open();
+}
+
+// Counters are read last on entry and first on exit, so as little of
+// PERF{ itself is counted as we can manage
+void Interpreter::perf_begin() {
+    perf_.open();
+    const auto start = std::chrono::steady_clock::now();
+    perf_marks_.push_back({start, perf_.read()});
+}
+
+void Interpreter::perf_end(const std::string& region) {
+    const PerfCounts counts = perf_.read();
+    const auto end = std::chrono::steady_clock::now();
+    if (perf_marks_.empty()) {
+        return;
+    }
+    const PerfMark mark = perf_marks_.back();
+    perf_marks_.pop_back();
+    char ms[32];
+    std::snprintf(ms, sizeof ms, "%.3f ms", std::chrono::duration<double, std::milli>(end - mark.start).count());
+    out_.paint<Color::Green>("PERF{ ") << region;
+    out_.paint<Color::Green>(" }PERF: ") << std::string_view(ms);
+    if (perf_.available()) {
+        out_ << ", ";
+        perf_.print(out_, counts - mark.counts);
+        out_ << '\n';
+    } else {
+        out_ << " (counters unavailable: " << perf_.reason() << ")\n";
+    }
+}
+
+namespace {
+
+// The least time steady_clock reports between two back-to-back reads. It is
+// taken off each BENCH run, so short blocks are not dominated by the clock.
+std::int64_t clock_overhead() {
+    static const std::int64_t overhead = [] {
+        using std::chrono::steady_clock;
+        std::int64_t least = INT64_MAX;
+        for (int i = 0; i < 1000; ++i) {
+            const auto start = steady_clock::now();
+            const auto end = steady_clock::now();
+            least = std::min<std::int64_t>(least, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+        return least;
+    }();
+    return overhead;
+}
+
+} // namespace
+
+// A tenth of the runs, at least one, warm caches and branch predictors
+// before timing starts
+void Interpreter::bench_begin(std::int64_t runs, const std::string& label) {
+    clock_overhead();
+    BenchFrame& bench = benches_.emplace_back();
+    bench.label = &label;
+    bench.warmup = std::max<std::int64_t>(1, runs / 10);
+    bench.runs = runs;
+    bench.samples.reserve(static_cast<std::size_t>(runs));
+    bench.data_stack = data_stack_;
+    bench.float_stack = float_stack_;
+    bench.start = std::chrono::steady_clock::now();
+}
+
+// A run of the innermost BENCH block ended. True to run it again; false,
+// after reporting, when it has run enough.
+bool Interpreter::bench_next() {
+    const auto end = std::chrono::steady_clock::now();
+    BenchFrame& bench = benches_.back();
+    if (bench.warmup > 0) {
+        --bench.warmup;
+    } else {
+        const std::int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - bench.start).count();
+        bench.samples.push_back(std::max<std::int64_t>(0, ns - clock_overhead()));
+    }
+    if (static_cast<std::int64_t>(bench.samples.size()) < bench.runs) {
+        data_stack_ = bench.data_stack;
+        float_stack_ = bench.float_stack;
+        bench.start = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    std::vector<std::int64_t>& samples = bench.samples;
+    std::sort(samples.begin(), samples.end());
+    const std::size_t n = samples.size();
+    const std::int64_t median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    const std::int64_t p99 = samples[(n * 99 + 99) / 100 - 1];
+    out_.paint<Color::Green>("BENCH ") << *bench.label;
+    out_.paint<Color::Green>(": ") << static_cast<std::uint64_t>(n) << " runs, min " << samples.front()
+                                   << " ns, median " << median << " ns, p99 " << p99 << " ns\n";
+    benches_.pop_back();
+    return false;
+}
+
+} // namespace cbasic
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace cbasic {
+
+// -----------------------------
+// Single-producer, single-consumer ring
+// -----------------------------
+// A bounded lock-free queue between exactly two threads. Each side owns one
+// index and keeps a cached copy of the other's, so a push or pop touches
+// the shared cache lines only when the cached view says the ring is full or
+// empty. push() and pop() block on the other side's index with
+// std::atomic::wait, which costs no system call while nobody is waiting.
+
+// Keeps the two sides' indices off each other's cache line
+inline constexpr std::size_t CACHE_LINE = 64;
+
+template <typename T, std::size_t N>
+class SpscRing {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "ring capacity must be a power of two");
+
+public:
+    // Producer side. False, leaving `item` alone, if the ring is full.
+    bool try_push(T& item) {
+        const std::size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_seen_ == N) {
+            head_seen_ = head_.load(std::memory_order_acquire);
+            if (tail - head_seen_ == N) {
+                return false;
+            }
+        }
+        slots_[tail & (N - 1)] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_release);
+        tail_.notify_one();
+        return true;
+    }
+
+    void push(T item) {
+        while (!try_push(item)) {
+            head_.wait(head_seen_, std::memory_order_acquire);
+        }
+    }
+
+    // Consumer side. False if the ring is empty.
+    bool try_pop(T& item) {
+        const std::size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_seen_) {
+            tail_seen_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_seen_) {
+                return false;
+            }
+        }
+        item = std::move(slots_[head & (N - 1)]);
+        head_.store(head + 1, std::memory_order_release);
+        head_.notify_one();
+        return true;
+    }
+
+    T pop() {
+        T item;
+        while (!try_pop(item)) {
+            tail_.wait(tail_seen_, std::memory_order_acquire);
+        }
+        return item;
+    }
+
+    // Consumer side: whether pop() would block
+    bool empty() {
+        return head_.load(std::memory_order_relaxed) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    alignas(CACHE_LINE) std::atomic<std::size_t> head_{0};  // next slot to pop
+    std::size_t tail_seen_ = 0;                             // consumer's copy of tail_
+    alignas(CACHE_LINE) std::atomic<std::size_t> tail_{0};  // next slot to push
+    std::size_t head_seen_ = 0;                             // producer's copy of head_
+    alignas(CACHE_LINE) std::array<T, N> slots_{};
+};
+
+} // namespace cbasic
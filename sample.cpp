@@ -0,0 +1,266 @@
+#include "sample.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CBASIC_SAMPLE_SIGPROF 1
+#include <cerrno>
+#include <csignal>
+#include <pthread.h>
+#include <sys/time.h>
+#endif
+
+namespace cbasic {
+
+namespace {
+
+// The sampling interpreter's sampler: the timer is process-wide
+std::atomic<Sampler*> active{nullptr};
+
+#ifdef CBASIC_SAMPLE_SIGPROF
+// Holds SIGPROF off while the table is read or cleared
+class BlockSignal {
+public:
+    BlockSignal() {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGPROF);
+        pthread_sigmask(SIG_BLOCK, &set, &old_);
+    }
+    ~BlockSignal() { pthread_sigmask(SIG_SETMASK, &old_, nullptr); }
+
+    BlockSignal(const BlockSignal&) = delete;
+    BlockSignal& operator=(const BlockSignal&) = delete;
+
+private:
+    sigset_t old_;
+};
+#else
+struct BlockSignal {};
+#endif
+
+std::uint64_t mix(std::uint64_t hash, std::uint64_t value) {
+    return (hash ^ value) * 1099511628211ull;
+}
+
+} // namespace
+
+void Sampler::on_signal(int) {
+#ifdef CBASIC_SAMPLE_SIGPROF
+    const int saved = errno;
+    Sampler* sampler = active.load(std::memory_order_acquire);
+    if (sampler && sampler->owner_ == std::this_thread::get_id()) {
+        sampler->take();
+    }
+    errno = saved;
+#endif
+}
+
+// In the signal handler: count the current stack
+void Sampler::take() {
+    const std::uint32_t depth = depth_.load(std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_acquire);
+    const std::uint32_t recorded = std::min<std::uint32_t>(depth, MAX_DEPTH);
+    const std::uint32_t first = recorded > MAX_FRAMES ? recorded - static_cast<std::uint32_t>(MAX_FRAMES) : 0;
+    const std::uint32_t frames = recorded - first;
+    const std::uint32_t line = line_.load(std::memory_order_relaxed);
+    const bool truncated = depth > frames;
+
+    std::uint64_t hash = mix(mix(14695981039346656037ull, line), truncated);
+    for (std::uint32_t i = first; i < recorded; ++i) {
+        hash = mix(hash, reinterpret_cast<std::uintptr_t>(stack_[i]));
+    }
+    for (std::size_t probe = 0; probe < 16; ++probe) {
+        Slot& slot = table_[(hash + probe) & (TABLE - 1)];
+        if (slot.count == 0) {
+            slot.hash = hash;
+            slot.line = line;
+            slot.depth = depth;
+            slot.frames = frames;
+            std::copy(stack_.begin() + first, stack_.begin() + recorded, slot.frame);
+            slot.count = 1;
+            pending_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (slot.hash == hash && slot.line == line && slot.frames == frames && (slot.depth > frames) == truncated &&
+            std::equal(slot.frame, slot.frame + frames, stack_.begin() + first)) {
+            ++slot.count;
+            pending_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool Sampler::start() {
+#ifdef CBASIC_SAMPLE_SIGPROF
+    if (running_) {
+        return true;
+    }
+    if (!table_) {
+        table_ = std::make_unique<Slot[]>(TABLE);
+    }
+    owner_ = std::this_thread::get_id();
+    Sampler* expected = nullptr;
+    if (!active.compare_exchange_strong(expected, this, std::memory_order_acq_rel)) {
+        return false;
+    }
+    static std::once_flag installed;
+    std::call_once(installed, [] {
+        struct sigaction action {};
+        action.sa_handler = &Sampler::on_signal;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGPROF, &action, nullptr);
+    });
+    itimerval timer{{0, INTERVAL_US}, {0, INTERVAL_US}};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    running_ = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Sampler::stop() {
+#ifdef CBASIC_SAMPLE_SIGPROF
+    if (!running_) {
+        return;
+    }
+    itimerval off{};
+    setitimer(ITIMER_PROF, &off, nullptr);
+    active.store(nullptr, std::memory_order_release);
+    running_ = false;
+#endif
+}
+
+void Sampler::drain() {
+    if (!pending()) {
+        return;
+    }
+    BlockSignal block;
+    for (std::size_t i = 0; i < TABLE; ++i) {
+        Slot& slot = table_[i];
+        if (slot.count == 0) {
+            continue;
+        }
+        std::string stack = slot.line != 0 ? "line " + std::to_string(slot.line) : std::string("line ?");
+        if (slot.depth > slot.frames) {
+            stack += ";...";
+        }
+        for (std::uint32_t k = 0; k < slot.frames; ++k) {
+            // Lines have no name; a line run by a builtin adds no frame
+            if (!slot.frame[k]->name.empty()) {
+                stack += ';';
+                stack += slot.frame[k]->name;
+            }
+        }
+        stacks_[stack] += slot.count;
+        samples_ += slot.count;
+        slot.count = 0;
+    }
+    pending_.store(0, std::memory_order_relaxed);
+}
+
+void Sampler::reset() {
+    BlockSignal block;
+    if (table_) {
+        for (std::size_t i = 0; i < TABLE; ++i) {
+            table_[i].count = 0;
+        }
+    }
+    pending_.store(0, std::memory_order_relaxed);
+    dropped_.store(0, std::memory_order_relaxed);
+    stacks_.clear();
+    samples_ = 0;
+}
+
+void Sampler::report(OutputSink& out) const {
+    struct Count {
+        std::string_view name;
+        std::uint64_t self = 0;
+        std::uint64_t total = 0;
+    };
+    std::vector<Count> words;
+    std::vector<Count> lines;
+    std::unordered_map<std::string_view, std::size_t> word_index;
+    std::unordered_map<std::string_view, std::size_t> line_index;
+    auto count = [](std::vector<Count>& counts, std::unordered_map<std::string_view, std::size_t>& index,
+                    std::string_view name) -> Count& {
+        auto [it, inserted] = index.try_emplace(name, counts.size());
+        if (inserted) {
+            counts.push_back({name});
+        }
+        return counts[it->second];
+    };
+    std::unordered_set<std::string_view> seen;
+    for (const auto& [stack, samples] : stacks_) {
+        std::string_view rest = stack;
+        auto next = [&] {
+            const std::size_t end = rest.find(';');
+            std::string_view frame = rest.substr(0, end);
+            rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+            return frame;
+        };
+        count(lines, line_index, next()).self += samples;
+        std::string_view innermost = "(top level)";
+        seen.clear();
+        while (!rest.empty()) {
+            std::string_view frame = next();
+            if (frame == "...") {
+                continue;
+            }
+            innermost = frame;
+            if (seen.insert(frame).second) {
+                count(words, word_index, frame).total += samples;
+            }
+        }
+        Count& self = count(words, word_index, innermost);
+        self.self += samples;
+        if (innermost == "(top level)") {
+            self.total += samples;
+        }
+    }
+    std::sort(words.begin(), words.end(), [](const Count& a, const Count& b) { return a.self > b.self; });
+    std::sort(lines.begin(), lines.end(), [](const Count& a, const Count& b) { return a.self > b.self; });
+
+    auto percent = [&](std::uint64_t n) { return samples_ ? 100.0 * static_cast<double>(n) / static_cast<double>(samples_) : 0.0; };
+    char text[160];
+    out.paint<Color::Green>("Samples: ") << samples_ << " (" << INTERVAL_US << " us of CPU each), "
+                                          << dropped_.load(std::memory_order_relaxed) << " dropped\n";
+    std::snprintf(text, sizeof text, "%-24s %8s %8s %10s\n", "word", "self %", "total %", "samples");
+    out << std::string_view(text);
+    for (const Count& word : words) {
+        std::snprintf(text, sizeof text, "%-24.*s %8.1f %8.1f %10llu\n", static_cast<int>(std::min<std::size_t>(word.name.size(), 24)),
+                      word.name.data(),
+                      percent(word.self), percent(word.total), static_cast<unsigned long long>(word.self));
+        out << std::string_view(text);
+    }
+    std::snprintf(text, sizeof text, "%-24s %8s %19s\n", "line", "%", "samples");
+    out << std::string_view(text);
+    for (const Count& line : lines) {
+        std::snprintf(text, sizeof text, "%-24.*s %8.1f %19llu\n", static_cast<int>(std::min<std::size_t>(line.name.size(), 24)),
+                      line.name.data(),
+                      percent(line.self), static_cast<unsigned long long>(line.self));
+        out << std::string_view(text);
+    }
+}
+
+bool Sampler::write_folded(const std::string& path) const {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+    for (const auto& [stack, samples] : stacks_) {
+        file << stack << ' ' << samples << '\n';
+    }
+    return static_cast<bool>(file.flush());
+}
+
+} // namespace cbasic
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "bytecode.hpp"
+#include "output.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace cbasic {
+
+// -----------------------------
+// Sampling profiler
+// -----------------------------
+// SAMPLE ON starts a SIGPROF interval timer (setitimer ITIMER_PROF, every
+// millisecond of CPU time). At each tick the signal handler reads the VM's
+// shadow call stack and the source line being run, and counts the sample
+// in a preallocated table. It allocates nothing and takes no locks.
+// Each distinct stack gets one slot.
+//
+// The shadow call stack has one frame per running line or colon
+// definition. execute() pushes and pops it with a few plain stores, so a
+// word call costs nothing more than that while no timer is running. The
+// frames are Code pointers. They are only valid while their line or
+// definition exists, so the interpreter drains the table into named stacks
+// at the end of each line that was sampled, and before reset, restore or
+// load_image drop definitions.
+//
+// ITIMER_PROF counts the whole process, so one interpreter at a time can
+// sample. Ticks that land on other threads are ignored.
+//
+// Samples are attributed to the top-level line running, by its 1-based
+// number in the source it came from: the script or library passed to
+// eval() or load_library(), or the input stream. Samples in a colon
+// definition count toward the line that called it. Lines from different
+// sources with the same number share a row.
+
+class Sampler {
+public:
+    static constexpr std::size_t MAX_DEPTH = 256;  // frames the shadow stack records
+    static constexpr std::size_t MAX_FRAMES = 16;  // innermost frames kept per sample
+    static constexpr std::size_t TABLE = 1024;     // distinct stacks between drains
+    static constexpr long INTERVAL_US = 1000;
+
+    Sampler() = default;
+    ~Sampler() { stop(); }
+
+    Sampler(const Sampler&) = delete;
+    Sampler& operator=(const Sampler&) = delete;
+
+    // A frame of the shadow call stack
+    class Frame {
+    public:
+        Frame(Sampler& sampler, const Code& code) : sampler_(sampler) {
+            const std::uint32_t depth = sampler.depth_.load(std::memory_order_relaxed);
+            if (depth < MAX_DEPTH) {
+                sampler.stack_[depth] = &code;
+            }
+            std::atomic_signal_fence(std::memory_order_release);
+            sampler.depth_.store(depth + 1, std::memory_order_relaxed);
+        }
+
+        ~Frame() {
+            sampler_.depth_.store(sampler_.depth_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+        }
+
+        Frame(const Frame&) = delete;
+        Frame& operator=(const Frame&) = delete;
+
+    private:
+        Sampler& sampler_;
+    };
+
+    // Line `line` of its source is about to run; 0 if it has no number
+    void begin_line(std::uint32_t line) { line_.store(line, std::memory_order_relaxed); }
+
+    // Whether the table holds samples not yet drained
+    bool pending() const { return pending_.load(std::memory_order_relaxed) != 0; }
+
+    // Start the timer. False if sampling is not supported here, or another
+    // interpreter is sampling.
+    bool start();
+    void stop();
+    bool running() const { return running_; }
+
+    // Name the samples in the table and add them to the totals. Every Code
+    // the table points to must still exist.
+    void drain();
+
+    // Drop the totals
+    void reset();
+
+    // Samples per word (innermost, and anywhere on the stack) and per line
+    void report(OutputSink& out) const;
+
+    // One "line N;caller;...;word samples" line per stack, for flame graphs.
+    // False if `path` cannot be written.
+    bool write_folded(const std::string& path) const;
+
+private:
+    struct Slot {
+        std::uint64_t hash;
+        std::uint64_t count;  // 0: free
+        std::uint32_t line;
+        std::uint32_t depth;   // the full depth, of which `frames` were kept
+        std::uint32_t frames;
+        const Code* frame[MAX_FRAMES];
+    };
+
+    static void on_signal(int);
+    void take();
+
+    std::atomic<std::uint32_t> depth_{0};
+    std::atomic<std::uint32_t> line_{0};
+    std::array<const Code*, MAX_DEPTH> stack_{};
+
+    std::unique_ptr<Slot[]> table_;  // allocated by start(), written by the handler
+    std::atomic<std::uint64_t> pending_{0};
+    std::atomic<std::uint64_t> dropped_{0};  // samples that found the table full
+    std::thread::id owner_;
+    bool running_ = false;
+
+    std::map<std::string, std::uint64_t> stacks_;  // folded stack -> samples
+    std::uint64_t samples_ = 0;
+};
+
+} // namespace cbasic
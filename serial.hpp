@@ -0,0 +1,290 @@
+#pragma once
+
+#include "bytecode.hpp"
+#include "pipeline.hpp"
+#include "profile.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cbasic {
+
+// -----------------------------
+// Serialization
+// -----------------------------
+// Native-endian binary encoding for image and cache files: fixed-size
+// values as their bytes, strings as a 32-bit length and the bytes. These
+// files are read back on the machine that wrote them, and are versioned by
+// their users.
+class ByteWriter {
+public:
+    template <typename T>
+    void put(T value) {
+        const auto* p = reinterpret_cast<const char*>(&value);
+        bytes_.append(p, sizeof value);
+    }
+
+    void put(std::string_view text) {
+        put(static_cast<std::uint32_t>(text.size()));
+        bytes_.append(text);
+    }
+
+    const std::string& bytes() const { return bytes_; }
+
+private:
+    std::string bytes_;
+};
+
+// Bounds-checked reads: once a read fails all later ones do too, so the
+// caller checks ok() once at the end
+class ByteReader {
+public:
+    ByteReader(const char* data, std::size_t size) : data_(data), size_(size) {}
+
+    template <typename T>
+    T get() {
+        T value{};
+        if (ok_ && sizeof value <= size_ - pos_) {
+            std::memcpy(&value, data_ + pos_, sizeof value);
+            pos_ += sizeof value;
+        } else {
+            ok_ = false;
+        }
+        return value;
+    }
+
+    std::string get_string() {
+        auto n = get<std::uint32_t>();
+        if (!ok_ || n > size_ - pos_) {
+            ok_ = false;
+            return {};
+        }
+        std::string text(data_ + pos_, n);
+        pos_ += n;
+        return text;
+    }
+
+    // A count of items at least `item` bytes each, checked against what is left
+    std::uint32_t get_count(std::size_t item) {
+        auto n = get<std::uint32_t>();
+        if (ok_ && n > (size_ - pos_) / item) {
+            ok_ = false;
+        }
+        return ok_ ? n : 0;
+    }
+
+    bool ok() const { return ok_; }
+
+private:
+    const char* data_;
+    std::size_t size_;
+    std::size_t pos_ = 0;
+    bool ok_ = true;
+};
+
+
+// Code as its raw instructions, its strings and its name. `fix(instruction)` may
+// rewrite each instruction on the way in or out (image relocation); if it
+// returns false, so do put_code and get_code.
+template <typename Fix>
+bool put_code(ByteWriter& out, const Code& code, Fix fix) {
+    out.put(static_cast<std::uint32_t>(code.instructions.size()));
+    for (const Instruction& in : code.instructions) {
+        Instruction copy;
+        std::memset(static_cast<void*>(&copy), 0, sizeof copy);  // deterministic padding
+        copy.op = in.op;
+        copy.slot = in.slot;
+        copy.arg = in.arg;
+        copy.value = in.value;
+        if (!fix(copy)) {
+            return false;
+        }
+        out.put(copy);
+    }
+    out.put(static_cast<std::uint32_t>(code.strings.size()));
+    for (const auto& text : code.strings) {
+        out.put(std::string_view(text));
+    }
+    out.put(std::string_view(code.name));
+    return true;
+}
+
+// Null if the input is short or `fix` fails
+template <typename Fix>
+std::shared_ptr<Code> get_code(ByteReader& in, Fix fix) {
+    auto code = std::make_shared<Code>();
+    code->instructions.resize(in.get_count(sizeof(Instruction)));
+    for (Instruction& instruction : code->instructions) {
+        instruction = in.get<Instruction>();
+        if (!fix(instruction)) {
+            return nullptr;
+        }
+    }
+    code->strings.resize(in.get_count(4));
+    for (auto& text : code->strings) {
+        text = in.get_string();
+    }
+    code->name = in.get_string();
+    return in.ok() ? code : nullptr;
+}
+
+// What an instruction expects the VM to have pushed before it, counting only
+// what the same code pushed: FOR loops, and TIME{, BENCH and PERF{ blocks
+struct Nesting {
+    std::uint32_t loops = 0;
+    std::uint32_t times = 0;
+    std::uint32_t benches = 0;
+    std::uint32_t perfs = 0;
+
+    bool operator==(const Nesting&) const = default;
+};
+
+// Operands name things that exist
+inline bool valid_operands(const Code& code, const Instruction& in, std::size_t definitions, std::size_t arrays) {
+    switch (in.op) {
+        case Op::Push:
+            // Array literals name DIM arrays; expressions never outlive a line
+            return !in.value.is_expr() && (!in.value.is_array() || in.value.as_array() < arrays);
+        case Op::RangeCheck:
+            return in.value.is_int() && static_cast<std::uint64_t>(in.value.as_int()) < arrays;
+        case Op::Dim:
+        case Op::ALoad:
+        case Op::AStore:
+        case Op::ALoadLoop:
+        case Op::AStoreLoop:
+        case Op::AAssign:
+            return in.arg < arrays;
+        case Op::Map:
+            return in.arg <= static_cast<std::uint32_t>(MapFn::Square);
+        case Op::Zip:
+            return in.arg <= static_cast<std::uint32_t>(ZipFn::Min);
+        case Op::Reduce:
+            return in.arg <= static_cast<std::uint32_t>(ZipFn::Min) && in.arg != static_cast<std::uint32_t>(ZipFn::Sub);
+        case Op::Filter:
+            return in.arg <= static_cast<std::uint32_t>(Compare::NotEqual);
+        case Op::ExecLocal:
+            return in.arg < definitions;
+        case Op::SaveImage:
+        case Op::PerfBegin:
+        case Op::PerfEnd:
+        case Op::Error:
+            return in.arg < code.strings.size();
+        case Op::BenchBegin:
+            return in.arg < code.strings.size() && in.value.is_int() && in.value.as_int() >= 1;
+        case Op::Profile:
+        case Op::Sample:
+            return in.arg < code.strings.size() && in.slot < PROFILE_COMMANDS.size();
+        default:
+            return static_cast<std::uint32_t>(in.op) < OP_COUNT;
+    }
+}
+
+// Code from an image or cache file is safe to run: operands name things
+// that exist, jumps stay inside the code, and along every path loops and
+// blocks are entered before they are used or left, and are all left by the
+// end. Versioned FOR loops have two bodies under one ForBegin, so nesting
+// is followed along the jumps rather than counted in order.
+inline bool valid_code(const Code& code, std::size_t definitions, std::size_t arrays) {
+    const std::size_t count = code.instructions.size();
+    for (const Instruction& in : code.instructions) {
+        if (!valid_operands(code, in, definitions, arrays)) {
+            return false;
+        }
+    }
+
+    // Each instruction is reached with one nesting, or the code is rejected
+    std::vector<Nesting> nesting(count + 1);
+    std::vector<bool> reached(count + 1, false);
+    std::vector<std::size_t> work{0};
+    reached[0] = true;
+    auto reach = [&](std::int64_t target, Nesting at) {
+        if (target < 0 || target > static_cast<std::int64_t>(count)) {
+            return false;
+        }
+        const auto pc = static_cast<std::size_t>(target);
+        if (reached[pc]) {
+            return nesting[pc] == at;
+        }
+        reached[pc] = true;
+        nesting[pc] = at;
+        work.push_back(pc);
+        return true;
+    };
+    while (!work.empty()) {
+        const std::size_t pc = work.back();
+        work.pop_back();
+        const Nesting at = nesting[pc];
+        if (pc == count) {
+            if (at != Nesting{}) {
+                return false;
+            }
+            continue;
+        }
+        const Instruction& in = code.instructions[pc];
+        const std::int64_t next = static_cast<std::int64_t>(pc) + 1;
+        const std::int64_t target = static_cast<std::int64_t>(pc) + static_cast<std::int32_t>(in.arg);
+        Nesting inner = at;
+        Nesting outer = at;
+        bool ok = true;
+        switch (in.op) {
+            case Op::Jump:
+                ok = reach(target, at);
+                break;
+            case Op::ForBegin:
+                ++inner.loops;
+                ok = reach(target, at) && reach(next, inner);
+                break;
+            case Op::Next:
+                ok = at.loops > 0 && reach(target, at) && (--outer.loops, reach(next, outer));
+                break;
+            case Op::RangeCheck:
+            case Op::LoopIndex:
+            case Op::ALoadLoop:
+            case Op::AStoreLoop:
+                ok = in.slot < at.loops && (in.op != Op::RangeCheck || reach(target, at)) && reach(next, at);
+                break;
+            case Op::TimeBegin:
+                ++inner.times;
+                ok = reach(next, inner);
+                break;
+            case Op::TimeEnd:
+                ok = at.times > 0 && (--outer.times, reach(next, outer));
+                break;
+            case Op::BenchBegin:
+                ++inner.benches;
+                ok = reach(next, inner);
+                break;
+            case Op::BenchEnd:
+                ok = at.benches > 0 && reach(target, at) && (--outer.benches, reach(next, outer));
+                break;
+            case Op::PerfBegin:
+                ++inner.perfs;
+                ok = reach(next, inner);
+                break;
+            case Op::PerfEnd:
+                ok = at.perfs > 0 && (--outer.perfs, reach(next, outer));
+                break;
+            default:
+                ok = reach(next, at);
+                break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A dictionary word compiles to its op and arg alone, in any line, so it
+// must be valid code by itself
+inline bool valid_word(Op op, std::uint32_t arg, std::size_t definitions, std::size_t arrays) {
+    Code code;
+    code.instructions.push_back({op, 0, arg});
+    return valid_code(code, definitions, arrays);
+}
+
+} // namespace cbasic
@@ -0,0 +1,1091 @@
+// Regression tests, run by ctest. Each test is a function that returns
+// normally or fails a CHECK; the binary exits non-zero if any failed.
+#include "cbasic.hpp"
+#include "input.hpp"
+#include "jobs.hpp"
+#include "kernels.hpp"
+#include "serial.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition)                                                                  \
+    do {                                                                                  \
+        if (!(condition)) {                                                               \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            ++failures;                                                                   \
+        }                                                                                 \
+    } while (0)
+
+bool contains(std::string_view text, std::string_view part) {
+    return text.find(part) != std::string_view::npos;
+}
+
+// What `script` prints when evaluated in `interpreter`
+std::string eval(cbasic::Interpreter& interpreter, std::string_view script, std::ostringstream& out) {
+    out.str({});
+    interpreter.eval(script);
+    interpreter.flush();
+    return out.str();
+}
+
+// -----------------------------
+// Parsing
+// -----------------------------
+// The combinators that are checked in constant evaluation in cnomlite.hpp
+// give the same results on input only known at runtime
+void test_parsers_at_runtime() {
+    using namespace cnomlite;
+    const std::string input = std::string("10, 20,") + "30 rest";
+    auto list = sep_by(skip_ws(integer_p), skip_ws(char_p(',')))(input);
+    auto* ints = std::get_if<ParseSuccess<std::vector<int>>>(&list);
+    CHECK(ints && ints->value == std::vector<int>({10, 20, 30}) && ints->remaining == " rest");
+    CHECK(ints && ints->offset(input) == 9);
+
+    const std::string op = "MUL 2";
+    auto picked = choice(string_p("ADD"), string_p("SUB"))(op);
+    auto* error = std::get_if<ParseError>(&picked);
+    CHECK(error && error->offset(op) == 0);
+    CHECK(error && contains(error->message(), ", found \"MUL\""));
+}
+
+// iequals folds only A-Z, on both sides of the 16-byte blocks it compares
+// at a time; other bytes, UTF-8 included, must match exactly
+void test_iequals() {
+    using cnomlite::iequals;
+    CHECK(iequals("FoR", "for") && !iequals("for", "fo") && !iequals("[", "{") && !iequals("@", "`"));
+    for (std::size_t n : {1, 15, 16, 17, 31, 32, 40}) {
+        for (std::size_t i = 0; i < n; ++i) {
+            // "qq..qq" and "QQ..QQ" with one byte replaced
+            auto same = [&](char x, char y) {
+                std::string a(n, 'q'), b(n, 'Q');
+                a[i] = x;
+                b[i] = y;
+                return iequals(a, b);
+            };
+            CHECK(same('q', 'Q') && same('A', 'a') && same('Z', 'z'));
+            CHECK(!same('@', '`') && !same('[', '{') && !same('\xC3', '\xE3'));
+        }
+    }
+    const std::string line = "pRiNt 1";
+    auto print = cnomlite::istring_p("PRINT")(line);
+    auto* matched = std::get_if<cnomlite::ParseSuccess<std::string_view>>(&print);
+    CHECK(matched && matched->value == "pRiNt" && matched->remaining == " 1");
+
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    CHECK(eval(interpreter, ": Twice 2 mul ;\n3 TWICE twice Print", out) == "Stack: 12 \n");
+}
+
+// utf8_validate skips ASCII 16 bytes at a time; a sequence starting at any
+// offset, including across a block edge, is checked the same way
+void test_utf8_validate() {
+    using cnomlite::utf8_validate;
+    constexpr auto npos = std::string_view::npos;
+    for (std::size_t i = 0; i < 40; ++i) {
+        auto with = [&](std::string_view sequence) {
+            std::string text(48, 'a');
+            text.replace(i, sequence.size(), sequence);
+            return utf8_validate(text);
+        };
+        CHECK(with("\xC3\xA4") == npos && with("\xE4\xB8\x96") == npos && with("\xF0\x9F\x98\x80") == npos);
+        CHECK(with("\xFF") == i && with("\x80") == i && with("\xC0\xAF") == i);
+        CHECK(with("\xE0\x80\x80") == i && with("\xED\xA0\x80") == i && with("\xF4\x90\x80\x80") == i);
+        CHECK(with("\xE4\xB8" "a") == i);
+    }
+    CHECK(utf8_validate(std::string(47, 'a') + "\xE4\xB8") == 47);
+
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    CHECK(contains(eval(interpreter, "1 \xFF 2", out), "invalid UTF-8 (byte 2)"));
+    CHECK(interpreter.data_stack().empty());
+}
+
+// Offsets map to 1-based lines and columns counted in code points, and
+// errors report the column of the word they are about
+void test_error_positions() {
+    const std::string source = "one\nä two\n\n世界 x";
+    cnomlite::LineIndex index(source);
+    auto at = [&](std::size_t offset) {
+        auto loc = index.locate(offset);
+        return std::to_string(loc.line) + ":" + std::to_string(loc.column);
+    };
+    CHECK(at(0) == "1:1" && at(3) == "1:4" && at(4) == "2:1");
+    CHECK(at(source.find("two")) == "2:3");
+    CHECK(at(source.find('\n', 4) + 1) == "3:1");
+    CHECK(at(source.find('x')) == "4:4" && at(source.size() + 5) == "4:5");
+
+    const std::string digits = "12 x";
+    auto parsed = cnomlite::skip_ws(cnomlite::integer_p)(std::string_view(digits).substr(2));
+    auto* error = std::get_if<cnomlite::ParseError>(&parsed);
+    CHECK(error && cnomlite::LineIndex(digits).describe(*error) == "1:4: Expected digit, found 'x'");
+
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    CHECK(contains(eval(interpreter, "  äb FOO", out), "Error: Unknown command 'FOO' at 1:6"));
+}
+
+// -----------------------------
+// Values
+// -----------------------------
+// Every tag round-trips through the 8-byte cell, and integers that leave
+// the 48-bit range become the nearest double
+void test_value_tags() {
+    using cbasic::Value;
+    constexpr std::int64_t max48 = (std::int64_t{1} << 47) - 1;
+    constexpr std::int64_t min48 = -(std::int64_t{1} << 47);
+    CHECK(Value::integer(-7).is_int() && Value::integer(-7).as_int() == -7);
+    CHECK(Value::integer(max48).is_int() && Value::integer(max48).as_int() == max48);
+    CHECK(Value::integer(min48).is_int() && Value::integer(min48).as_int() == min48);
+    CHECK(Value::integer(max48 + 1).is_float());
+    CHECK(Value::integer(max48 + 1).as_float() == static_cast<double>(max48 + 1));
+    CHECK(Value::real(2.5).is_float() && Value::real(2.5).as_float() == 2.5);
+    CHECK(Value::real(-0.0).is_float() && !Value::real(-0.0).is_reference());
+    const Value nan = Value::real(std::nan(""));
+    CHECK(nan.is_float() && !nan.is_reference() && nan.as_float() != nan.as_float());
+    CHECK(Value::array(3).is_array() && Value::array(3).as_array() == 3 && Value::array(3).is_reference());
+    CHECK(Value::expr(4).is_expr() && Value::expr(4).as_expr() == 4 && Value::expr(4).is_reference());
+    CHECK(both_int(Value::integer(1), Value::integer(-1)));
+    CHECK(!both_int(Value::integer(1), Value::real(1)));
+    CHECK(!both_int(Value::array(1), Value::integer(1)));
+    CHECK(Value::real(-2.7).to_int() == -2);
+}
+
+// Arithmetic stays integral while it fits, overflows to double, and mixes
+// ints with floats
+void test_value_arithmetic() {
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    CHECK(eval(interpreter, "2 3 MUL 7 SUB 1.5 ADD PRINT", out) == "Stack: 0.5 \n");
+    interpreter.data_stack().clear();
+    eval(interpreter, "140737488355327 1 ADD -140737488355328 1 SUB 3 4 MUL", out);
+    const auto& stack = interpreter.data_stack();
+    CHECK(stack.size() == 3);
+    CHECK(stack.size() == 3 && stack[0].is_float() && stack[0].as_float() == 140737488355328.0);
+    CHECK(stack.size() == 3 && stack[1].is_float() && stack[1].as_float() == -140737488355329.0);
+    CHECK(stack.size() == 3 && stack[2].is_int() && stack[2].as_int() == 12);
+}
+
+// -----------------------------
+// Float stack
+// -----------------------------
+// Float words work on their own stack and leave the data stack alone
+void test_float_stack() {
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    CHECK(eval(interpreter, "1.5e0 2.5e0 F+ F.", out) == "4\n");
+    CHECK(eval(interpreter, "1e0 2e0 FSWAP F- F.", out) == "1\n");
+    CHECK(eval(interpreter, "3e0 FDUP F* F.", out) == "9\n");
+    CHECK(eval(interpreter, "1e0 2e0 FDROP F.", out) == "1\n");
+    CHECK(eval(interpreter, "7 >F 2e0 F/ F>", out).empty());
+    CHECK(interpreter.float_stack().empty());
+    CHECK(interpreter.data_stack().size() == 1 && interpreter.data_stack()[0].is_float() &&
+          interpreter.data_stack()[0].as_float() == 3.5);
+    CHECK(eval(interpreter, "6.25e0 PRINT", out) == "Stack: 3.5 \nFloat stack: 6.25 \n");
+}
+
+// Too few floats is an error that leaves the float stack as it was
+void test_float_underflow() {
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    CHECK(contains(eval(interpreter, "1e0 F+", out), "Error: F+ requires at least 2 values on the float stack."));
+    CHECK(interpreter.float_stack().size() == 1 && interpreter.float_stack()[0] == 1.0);
+    CHECK(contains(eval(interpreter, "FDROP F.", out), "Error: F. requires at least 1 value on the float stack."));
+    CHECK(contains(eval(interpreter, "F>", out), "Error: F> requires at least 1 value on the float stack."));
+    CHECK(contains(eval(interpreter, ">F", out), "Error: >F requires a value on the stack."));
+    CHECK(interpreter.data_stack().empty() && interpreter.float_stack().empty());
+}
+
+// -----------------------------
+// Interpreters
+// -----------------------------
+// Interpreters share no state, so several can run at once on their own
+// threads, each with its own words, arrays and memory
+void test_interpreters_on_threads() {
+    constexpr int THREADS = 4;
+    std::vector<std::ostringstream> outs(THREADS);
+    bool ok[THREADS] = {};
+    {
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < THREADS; ++t) {
+            threads.emplace_back([&, t] {
+                cbasic::Interpreter interpreter(outs[t]);
+                const std::string k = std::to_string(t + 1);
+                ok[t] = interpreter.eval(": K " + k + " ; 1 CELLS ALLOT K 0 ! 999 DIM A%() A% AIOTA\n"
+                                         "FOR I = 1 TO 2000 A% K MUL ASUM 0 @ ADD 0 ! NEXT 0 @ PRINT");
+            });
+        }
+    }
+    for (int t = 0; t < THREADS; ++t) {
+        const std::int64_t k = t + 1;
+        CHECK(ok[t]);
+        CHECK(outs[t].str() == "Stack: " + std::to_string(k + 2000 * k * 499500) + " \n");
+    }
+}
+
+// A host registers its own words, runs scripts with eval() and reads the
+// results off the stack; a failed line does not stop the lines after it
+void test_embedding() {
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    std::vector<std::int64_t> sent;
+    interpreter.register_command("SEND", [&](cbasic::Interpreter& i) {
+        sent.push_back(i.data_stack().back().to_int());
+        i.data_stack().pop_back();
+    });
+    CHECK(interpreter.eval(": SQ 2 MUL ;\n3 SQ SEND 10 SQ"));
+    CHECK(sent == std::vector<std::int64_t>({6}));
+    CHECK(interpreter.data_stack().size() == 1 && interpreter.data_stack()[0].as_int() == 20);
+
+    CHECK(!interpreter.eval("NOPE\n4 SEND"));
+    CHECK(interpreter.error_count() == 1 && sent == std::vector<std::int64_t>({6, 4}));
+    interpreter.flush();
+    CHECK(out.str() == "Error: Unknown command 'NOPE' at 1:1\n");
+
+    interpreter.reset();
+    CHECK(interpreter.error_count() == 0 && interpreter.data_stack().empty());
+    CHECK(contains(eval(interpreter, "1 SQ", out), "Error: Unknown command 'SQ'"));
+    CHECK(eval(interpreter, "5 SEND", out).empty() && sent.back() == 5);
+}
+
+// -----------------------------
+// Jobs
+// -----------------------------
+// Results come back in script order whichever worker ran each job, and no
+// job sees the words, stack or errors of one before it
+void test_jobs_order_and_isolation() {
+    std::vector<std::string> scripts;
+    for (int i = 0; i < 40; ++i) {
+        const std::string n = std::to_string(i);
+        scripts.push_back(": MINE " + n + " ; FOR J = 1 TO " + std::to_string((40 - i) * 500) + " NEXT MINE TAG PRINT");
+    }
+    scripts[7] = "MINE";
+    cbasic::JobOptions options;
+    options.workers = 4;
+    options.setup = [](cbasic::Interpreter& i) {
+        i.register_command("TAG", [](cbasic::Interpreter& j) { j.push(cbasic::Value::integer(-1)); });
+    };
+    std::vector<std::size_t> emitted;
+    options.emit = [&](std::size_t index, const cbasic::JobResult&) { emitted.push_back(index); };
+    auto results = cbasic::run_jobs(scripts, options);
+    CHECK(results.size() == scripts.size() && emitted.size() == scripts.size());
+    for (std::size_t i = 0; i < results.size() && i < emitted.size(); ++i) {
+        CHECK(emitted[i] == i);
+        if (i == 7) {
+            CHECK(!results[i].ok && contains(results[i].output, "Error: Unknown command 'MINE'"));
+        } else {
+            CHECK(results[i].ok && results[i].output == "Stack: " + std::to_string(i) + " -1 \n");
+        }
+    }
+}
+
+// -----------------------------
+// Heap
+// -----------------------------
+// Memory released with a negative ALLOT must not reach the next job
+void test_jobs_clear_released_memory() {
+    cbasic::JobOptions options;
+    options.workers = 1;
+    auto results = cbasic::run_jobs({"64 ALLOT 4242 0 ! -64 ALLOT", "64 ALLOT 0 @ PRINT"}, options);
+    CHECK(results.size() == 2);
+    CHECK(results[1].output == "Stack: 0 \n");
+}
+
+// Likewise when every job starts from a snapshot
+void test_jobs_restore_released_memory() {
+    cbasic::Interpreter start;
+    start.eval(": NOTHING ;");
+    cbasic::JobOptions options;
+    options.workers = 1;
+    options.start = start.snapshot();
+    auto results = cbasic::run_jobs({"64 ALLOT 4242 0 ! -64 ALLOT", "64 ALLOT 0 @ PRINT"}, options);
+    CHECK(results.size() == 2);
+    CHECK(results[1].output == "Stack: 0 \n");
+}
+
+// Cells and bytes round-trip through memory below HERE, whatever their tag
+void test_heap_round_trip() {
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    CHECK(eval(interpreter, "HERE 2 CELLS ALLOT HERE PRINT", out) == "Stack: 0 16 \n");
+    interpreter.data_stack().clear();
+    CHECK(eval(interpreter, "-42 0 ! 2.5 8 ! 0 @ 8 @ PRINT", out) == "Stack: -42 2.5 \n");
+    interpreter.data_stack().clear();
+    CHECK(eval(interpreter, "300 15 C! 15 C@ 8 C@ PRINT", out) == "Stack: 44 0 \n");
+    interpreter.data_stack().clear();
+    CHECK(eval(interpreter, "-8 ALLOT HERE PRINT", out) == "Stack: 8 \n");
+}
+
+// Accesses that reach past HERE, and ALLOTs past either end of the heap,
+// are errors that leave memory as it was
+void test_heap_bounds() {
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    CHECK(contains(eval(interpreter, "0 @", out), "Error: @ address 0 is outside allotted memory (HERE = 0)."));
+    CHECK(contains(eval(interpreter, "8 ALLOT 1 @", out), "Error: @ address 1 is outside allotted memory (HERE = 8)."));
+    CHECK(contains(eval(interpreter, "5 8 !", out), "Error: ! address 8 is outside allotted memory (HERE = 8)."));
+    CHECK(contains(eval(interpreter, "8 C@", out), "Error: C@ address 8 is outside allotted memory (HERE = 8)."));
+    CHECK(contains(eval(interpreter, "5 -1 C!", out), "Error: C! address -1 is outside allotted memory (HERE = 8)."));
+    CHECK(contains(eval(interpreter, "-9 ALLOT", out), "Error: ALLOT -9 exceeds the heap."));
+    CHECK(contains(eval(interpreter, "1.5 ALLOT", out), "Error: ALLOT 1.5 exceeds the heap."));
+    CHECK(contains(eval(interpreter, "17179869184 ALLOT", out), "Error: ALLOT 17179869184 exceeds the heap."));
+    CHECK(interpreter.data_stack().empty());
+    CHECK(eval(interpreter, "HERE 7 C@ PRINT", out) == "Stack: 8 0 \n");
+}
+
+// -----------------------------
+// Arrays
+// -----------------------------
+// A loop body that resizes an array through a word call or a whole-array
+// TO keeps its bounds checks, so it reports the bad index instead of
+// writing past the array
+void test_loop_resize_keeps_checks() {
+    for (std::string_view loop : {"FOR I = 0 TO 3 SHRINK 7 TO A(I) NEXT", "FOR I = 0 TO 3 E TO A 7 TO A(I) NEXT"}) {
+        std::ostringstream out;
+        cbasic::Interpreter interpreter(out);
+        eval(interpreter, "DIM A(3) DIM C(3) DIM E(0)\n: SHRINK DIM A(0) DIM C(3) ;", out);
+        const std::string printed = eval(interpreter, std::string(loop) + "\nC(0) C(1) C(2) PRINT", out);
+        CHECK(contains(printed, "Error: index 1 is out of range for A(0..0)."));
+        CHECK(contains(printed, "Stack: 0 0 0 \n"));
+    }
+}
+
+// ADOT of two arrays runs the dot kernel; it must agree with the sum of
+// squares on both sides of every vector width, and with the fused path
+// for mixed element types
+void test_adot_sizes() {
+    for (std::int64_t n : {0, 1, 15, 16, 17, 1025}) {
+        std::ostringstream out;
+        cbasic::Interpreter interpreter(out);
+        const std::string count = std::to_string(n - 1);
+        eval(interpreter, count + " DIM A%() " + count + " DIM B() A% AIOTA B AIOTA\n"
+                          "A% A% ADOT B B ADOT A% B ADOT",
+             out);
+        const auto& stack = interpreter.data_stack();
+        const std::int64_t squares = (n - 1) * n * (2 * n - 1) / 6;
+        CHECK(interpreter.error_count() == 0);
+        CHECK(stack.size() == 3);
+        CHECK(stack.size() == 3 && stack[0].is_int() && stack[0].as_int() == squares);
+        CHECK(stack.size() == 3 && stack[1].to_double() == static_cast<double>(squares));
+        CHECK(stack.size() == 3 && stack[2].to_double() == static_cast<double>(squares));
+    }
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    CHECK(contains(eval(interpreter, "DIM A(3) DIM B(4) A B ADOT", out), "Error: ADOT needs arrays of equal length."));
+}
+
+// Elements read back what was stored; DIM gives indices 0..n, and a count
+// taken from the stack gives that many plus one
+void test_array_store_load() {
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    CHECK(eval(interpreter, "DIM A(3) 7 TO A(3) 2.5 TO A(0) A(0) A(1) A(3) PRINT", out) == "Stack: 2.5 0 7 \n");
+    interpreter.data_stack().clear();
+    CHECK(eval(interpreter, "DIM B%(2) 2.7 TO B%(1) -2.7 TO B%(2) B%(1) B%(2) PRINT", out) == "Stack: 2 -2 \n");
+    interpreter.data_stack().clear();
+    CHECK(eval(interpreter, "2 DIM C() C AIOTA C AMAX PRINT", out) == "Stack: 2 \n");
+    interpreter.data_stack().clear();
+    CHECK(contains(eval(interpreter, "A(4)", out), "Error: index 4 is out of range for A(0..3)."));
+    CHECK(contains(eval(interpreter, "1 TO A(-1)", out), "Error: index -1 is out of range for A(0..3)."));
+    CHECK(interpreter.data_stack().empty());
+}
+
+// A loop whose bounds fit the array runs with its checks hoisted and gives
+// the same result; one that overruns still reports every bad index and
+// keeps the writes that were in range
+void test_loop_bounds() {
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    CHECK(eval(interpreter, "DIM D(99) FOR I = 0 TO 99 I I MUL TO D(I) NEXT D ASUM PRINT", out) ==
+          "Stack: 328350 \n");
+    interpreter.data_stack().clear();
+    const std::string printed = eval(interpreter, "DIM A(3) FOR I = 0 TO 5 I TO A(I) NEXT\nA(0) A(1) A(2) A(3) PRINT", out);
+    CHECK(contains(printed, "Error: index 4 is out of range for A(0..3)."));
+    CHECK(contains(printed, "Error: index 5 is out of range for A(0..3)."));
+    CHECK(contains(printed, "Stack: 0 1 2 3 \n"));
+}
+
+// -----------------------------
+// Array kernels
+// -----------------------------
+// Every kernel agrees with a plain loop on both sides of every vector width,
+// and writes nothing past the n-th element
+template <typename T>
+void check_kernels(std::size_t n) {
+    namespace k = cbasic::kernels;
+    std::vector<T> a(n), b(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        a[i] = static_cast<T>(static_cast<std::int64_t>(i * 7 % 23) - 11);
+        b[i] = static_cast<T>(static_cast<std::int64_t>(i * 5 % 17) - 8);
+    }
+    const T sentinel = 12345;
+    auto expect = [&](auto f, auto kernel) {
+        std::vector<T> out(n + 1, sentinel);
+        kernel(out.data());
+        bool same = out[n] == sentinel;
+        for (std::size_t i = 0; i < n; ++i) {
+            same = same && out[i] == f(i);
+        }
+        return same;
+    };
+    CHECK(expect([&](std::size_t i) { return T(a[i] + b[i]); }, [&](T* out) { k::add(a.data(), b.data(), out, n); }));
+    CHECK(expect([&](std::size_t i) { return T(a[i] - b[i]); }, [&](T* out) { k::sub(a.data(), b.data(), out, n); }));
+    CHECK(expect([&](std::size_t i) { return T(a[i] * b[i]); }, [&](T* out) { k::mul(a.data(), b.data(), out, n); }));
+    CHECK(expect([&](std::size_t i) { return T(a[i] + 3); }, [&](T* out) { k::add(a.data(), T(3), out, n); }));
+    CHECK(expect([&](std::size_t i) { return T(a[i] - 3); }, [&](T* out) { k::sub(a.data(), T(3), out, n); }));
+    CHECK(expect([&](std::size_t i) { return T(a[i] * -3); }, [&](T* out) { k::mul(a.data(), T(-3), out, n); }));
+    CHECK(expect([&](std::size_t) { return T(9); }, [&](T* out) { k::fill(out, T(9), n); }));
+    CHECK(expect([&](std::size_t i) { return T(i); }, [&](T* out) { k::iota(out, n); }));
+
+    T sum = 0, dot = 0, max = std::numeric_limits<T>::lowest();
+    for (std::size_t i = 0; i < n; ++i) {
+        sum += a[i];
+        dot += a[i] * b[i];
+        max = a[i] > max ? a[i] : max;
+    }
+    CHECK(k::sum(a.data(), n) == sum);
+    CHECK(k::dot(a.data(), b.data(), n) == dot);
+    CHECK(k::max(a.data(), n) == max);
+
+    // In place, as the array words run them
+    std::vector<T> c = a;
+    k::add(c.data(), b.data(), c.data(), n);
+    k::mul(c.data(), T(2), c.data(), n);
+    bool same = true;
+    for (std::size_t i = 0; i < n; ++i) {
+        same = same && c[i] == T((a[i] + b[i]) * 2);
+    }
+    CHECK(same);
+}
+
+void test_kernels() {
+    for (std::size_t n : {0, 1, 15, 16, 17, 1025}) {
+        check_kernels<double>(n);
+        check_kernels<std::int64_t>(n);
+    }
+}
+
+// -----------------------------
+// Array pipelines
+// -----------------------------
+// A fused pipeline gives what the same steps give one whole array at a time,
+// over more elements than one block
+void test_pipeline_matches_eager() {
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    eval(interpreter, "4999 DIM A() 4999 DIM B%() A AIOTA B% AIOTA DIM T(0) DIM U(0) DIM V(0)\n"
+                      "A 0.5 MUL B% ZIP + MAP SQUARE ASUM\n"
+                      "A 0.5 MUL TO T T B% ZIP + TO U U MAP SQUARE TO V V ASUM",
+         out);
+    const auto& stack = interpreter.data_stack();
+    CHECK(interpreter.error_count() == 0);
+    CHECK(stack.size() == 2);
+    CHECK(stack.size() == 2 && stack[0].to_double() == 93721876875.0);
+    CHECK(stack.size() == 2 && stack[0].to_double() == stack[1].to_double());
+    CHECK(eval(interpreter, "U(4999) V(2)", out).empty());
+    CHECK(stack.size() == 4 && stack[2].to_double() == 7498.5 && stack[3].to_double() == 9.0);
+}
+
+// FILTER keeps matching elements in order, and REDUCE folds what is left
+void test_filter_reduce() {
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    CHECK(eval(interpreter, "99 DIM C%() C% AIOTA DIM D%(0)\n"
+                            "C% REDUCE + C% 10 FILTER >= TO D% D%(0) D% AMAX D% AIOTA D% AMAX\n"
+                            "C% 10 FILTER < REDUCE + C% 3 FILTER = ASUM C% 100 FILTER > ASUM C% 2 FILTER < REDUCE *\n"
+                            "PRINT",
+               out) == "Stack: 4950 10 99 89 45 3 0 0 \n");
+    CHECK(contains(eval(interpreter, "C% REDUCE -", out), "Error: REDUCE needs +, *, MAX or MIN"));
+    CHECK(contains(eval(interpreter, "C% 1 FILTER !", out), "Error: FILTER needs <, <=, >, >=, = or <>"));
+}
+
+// -----------------------------
+// Shared dictionary
+// -----------------------------
+// A base dictionary holding a copy of the standard words, so a test can
+// share words without other tests seeing them
+std::shared_ptr<cbasic::SharedDictionary> fresh_base() {
+    auto base = std::make_shared<cbasic::SharedDictionary>();
+    cbasic::SharedDictionary::Reader reader(*cbasic::standard_dictionary());
+    cbasic::SharedDictionary::Pin pin(reader);
+    base->publish([&](cbasic::DictionaryVersion& v) { v = *pin; });
+    return base;
+}
+
+// share() makes a word visible to every interpreter on the base, and an
+// interpreter's own word shadows a base word for that interpreter only
+void test_share_and_shadow() {
+    auto base = fresh_base();
+    std::ostringstream out_a, out_b, out_c;
+    cbasic::Interpreter a(out_a, base), b(out_b, base), c(out_c);
+    eval(a, ": TWICE 2 MUL ;", out_a);
+    a.register_command("SEVEN", [](cbasic::Interpreter& i) { i.push(cbasic::Value::integer(7)); });
+    CHECK(contains(eval(b, "3 TWICE", out_b), "Error: Unknown command 'TWICE'"));
+    b.data_stack().clear();
+    CHECK(a.share("TWICE") && a.share("SEVEN"));
+    CHECK(eval(a, "3 TWICE PRINT", out_a) == "Stack: 6 \n");
+    CHECK(eval(b, "3 TWICE SEVEN PRINT", out_b) == "Stack: 6 7 \n");
+    b.data_stack().clear();
+    CHECK(contains(eval(c, "3 TWICE", out_c), "Error: Unknown command 'TWICE'"));
+
+    eval(b, ": TWICE 3 MUL ;", out_b);
+    CHECK(eval(b, "4 TWICE PRINT", out_b) == "Stack: 12 \n");
+    a.data_stack().clear();
+    CHECK(eval(a, "4 TWICE PRINT", out_a) == "Stack: 8 \n");
+}
+
+// A definition that uses its interpreter's own arrays cannot be shared and
+// stays that interpreter's word
+void test_share_rejects_local_state() {
+    auto base = fresh_base();
+    std::ostringstream out_a, out_b;
+    cbasic::Interpreter a(out_a, base), b(out_b, base);
+    eval(a, "DIM L(2) 5 TO L(0)\n: FIRST L(0) ;", out_a);
+    CHECK(!a.share("FIRST"));
+    a.flush();
+    CHECK(contains(out_a.str(), "Error: FIRST uses this interpreter's own words or arrays and cannot be shared."));
+    CHECK(!a.share("MISSING"));
+    a.flush();
+    CHECK(contains(out_a.str(), "Error: Unknown command 'MISSING'"));
+    CHECK(eval(a, "FIRST PRINT", out_a) == "Stack: 5 \n");
+    CHECK(contains(eval(b, "FIRST", out_b), "Error: Unknown command 'FIRST'"));
+}
+
+// -----------------------------
+// Forks
+// -----------------------------
+// A fork starts with its parent's stacks, arrays, memory and words, and from
+// then on neither side sees the other's changes
+void test_fork_independence() {
+    std::ostringstream out_parent, out_child;
+    cbasic::Interpreter parent(out_parent);
+    parent.register_command("SEVEN", [](cbasic::Interpreter& i) { i.push(cbasic::Value::integer(7)); });
+    eval(parent, "2 CELLS ALLOT 42 8 ! DIM A(2) 5 TO A(1) : BUMP 1 ADD ; 1 2 3e0", out_parent);
+    auto child = parent.fork(out_child);
+
+    CHECK(eval(*child, "PRINT", out_child) == "Stack: 1 2 \nFloat stack: 3 \n");
+    CHECK(eval(*child, "A(1) 8 @ HERE 4 BUMP SEVEN PRINT", out_child) ==
+          "Stack: 1 2 5 42 40 5 7 \nFloat stack: 3 \n");
+    child->data_stack().resize(2);
+
+    eval(parent, "9 TO A(1) 0 8 ! 8 ALLOT : BUMP 2 ADD ; 4e0", out_parent);
+    CHECK(eval(*child, "A(1) 8 @ HERE 4 BUMP PRINT", out_child) == "Stack: 1 2 5 42 40 5 \nFloat stack: 3 \n");
+    child->data_stack().resize(2);
+
+    eval(*child, "6 TO A(1) 1 0 ! : BUMP 3 ADD ; DIM B(0) FDROP", out_child);
+    parent.data_stack().resize(2);
+    CHECK(eval(parent, "A(1) 8 @ 0 @ HERE 4 BUMP PRINT", out_parent) == "Stack: 1 2 9 0 0 48 6 \nFloat stack: 3 4 \n");
+    CHECK(contains(eval(parent, "B(0)", out_parent), "Error: Unknown array 'B'"));
+    CHECK(parent.error_count() == 1 && child->error_count() == 0);
+}
+
+// -----------------------------
+// Output
+// -----------------------------
+// Nothing reaches the stream before a flush or a full buffer, and what does
+// arrives whole and in order, however the writes were sized
+void test_output_buffering() {
+    using cbasic::OutputSink;
+    std::ostringstream out;
+    std::string expected;
+    {
+        OutputSink sink(out);
+        sink << "n=" << std::int64_t{-12} << ' ' << std::uint8_t{7} << ' ' << cbasic::Value::integer(3) << ' ' << 2.5;
+        expected = "n=-12 7 3 2.5";
+        CHECK(out.str().empty());
+        sink.flush();
+        CHECK(out.str() == expected);
+
+        // Single characters across a buffer boundary
+        for (std::size_t i = 0; i < OutputSink::CAPACITY + 10; ++i) {
+            const char c = static_cast<char>('a' + i % 26);
+            sink << c;
+            expected += c;
+        }
+        CHECK(out.str().size() == expected.size() - 10);
+        // A write that does not fit, and one larger than the whole buffer
+        const std::string half(OutputSink::CAPACITY / 2 + 1, 'x');
+        const std::string huge(OutputSink::CAPACITY * 2 + 3, 'y');
+        sink << half << half << huge << "end";
+        expected += half + half + huge + "end";
+    }
+    CHECK(out.str() == expected);
+}
+
+// Color writes the escape sequences around painted text only while it is on
+void test_output_color() {
+    std::ostringstream out;
+    cbasic::OutputSink sink(out);
+    sink.paint<cbasic::Color::Red>("plain");
+    sink.set_color(true);
+    sink.paint<cbasic::Color::Green>("green") << '.';
+    sink.set_color(false);
+    sink.paint<cbasic::Color::Cyan>("plain");
+    sink.flush();
+    CHECK(out.str() == "plain\033[32mgreen\033[0m.plain");
+
+    std::ostringstream printed;
+    cbasic::Interpreter interpreter(printed);
+    interpreter.out().set_color(true);
+    CHECK(eval(interpreter, "1 PRINT", printed) == "\033[32mStack: \033[0m1 \n");
+    interpreter.out().set_color(false);
+    interpreter.data_stack().clear();
+    CHECK(eval(interpreter, "1 PRINT", printed) == "Stack: 1 \n");
+}
+
+// -----------------------------
+// Piped input
+// -----------------------------
+// Piped lines run, print and report errors exactly as one eval() per line,
+// up to EXIT, whether the input ends in \n or \r\n. Which stages run on
+// threads depends on the CPU count, so this covers whichever this machine takes.
+void test_run_input_matches_eval() {
+    std::string script = ": SQ 2 MUL ;\r\n3 SQ PRINT\r\n\r\nFOO\n: SQ 3 MUL ;\n";
+    for (int i = 0; i < 3000; ++i) {
+        script += std::to_string(i) + " SQ DROPPED\n" + std::to_string(i) + " TO X\n";
+    }
+    script += "5 SQ PRINT\nexit\n9 PRINT\n";
+
+    std::ostringstream piped_out;
+    cbasic::Interpreter piped(piped_out);
+    std::istringstream in(script);
+    CHECK(!cbasic::run_input(piped, in));
+    piped.flush();
+
+    std::ostringstream expected_out;
+    cbasic::Interpreter expected(expected_out);
+    std::istringstream lines(script);
+    for (std::string line; std::getline(lines, line) && !cnomlite::iequals(line, "EXIT");) {
+        if (line.ends_with('\r')) {
+            line.pop_back();
+        }
+        expected.eval(line);
+    }
+    expected.flush();
+    CHECK(piped_out.str() == expected_out.str());
+    CHECK(contains(piped_out.str(), "Stack: 6 \nError: Unknown command 'FOO' at 1:1\n"));
+    CHECK(!contains(piped_out.str(), "Stack: 9"));
+    CHECK(piped.error_count() == expected.error_count());
+}
+
+// Input without errors, or without a final newline, runs to its last line
+void test_run_input_last_line() {
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    std::istringstream in("1\n2 ADD PRINT");
+    CHECK(cbasic::run_input(interpreter, in));
+    interpreter.flush();
+    CHECK(out.str() == "Stack: 3 \n");
+}
+
+// Batch input ends cleanly at EOF: empty input, blank lines, and EXIT as
+// the last line without a newline
+void test_run_input_eof() {
+    for (std::string_view script : {"", "\n\n\r\n", "1 PRINT\nEXIT", "1 PRINT\nexit\r\n2 PRINT"}) {
+        std::ostringstream out;
+        cbasic::Interpreter interpreter(out);
+        std::istringstream in{std::string(script)};
+        CHECK(cbasic::run_input(interpreter, in));
+        interpreter.flush();
+        CHECK(out.str() == (script.starts_with("1") ? "Stack: 1 \n" : ""));
+    }
+}
+
+// -----------------------------
+// Libraries
+// -----------------------------
+// A lazily compiled definition with invalid UTF-8 reports it on first call
+void test_library_invalid_utf8() {
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    interpreter.load_library(": X 1 \xF0 ;\n");
+    const std::string printed = eval(interpreter, "X", out);
+    CHECK(contains(printed, "invalid UTF-8"));
+}
+
+// A definition loaded lazily gets the same name as one loaded eagerly,
+// whatever whitespace separates its words
+void test_library_unicode_spacing() {
+    for (std::string_view space : {"\u00A0", "\v", "\u3000"}) {
+        const std::string line = ": SQ" + std::string(space) + "PRINT ;\n";
+        std::ostringstream eager_out;
+        cbasic::Interpreter eager(eager_out);
+        eager.eval(line);
+        std::ostringstream lazy_out;
+        cbasic::Interpreter lazy(lazy_out);
+        lazy.load_library(line);
+        const std::string expected = eval(eager, "5 SQ", eager_out);
+        CHECK(expected == "Stack: 5 \n");
+        CHECK(eval(lazy, "5 SQ", lazy_out) == expected);
+    }
+}
+
+// A lazily loaded word is replaced by a later definition of the same name,
+// from the library or from a script. A pending body's unknown words are
+// reported on its first call.
+void test_library_redefinition() {
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    interpreter.load_library(": SQ PRINT ;\n: SQ 7 ;\n");
+    CHECK(eval(interpreter, "SQ PRINT", out) == "Stack: 7 \n");
+
+    std::ostringstream later_out;
+    cbasic::Interpreter later(later_out);
+    later.load_library(": SQ PRINT ;\n");
+    CHECK(eval(later, ": SQ 7 ;\nSQ PRINT", later_out) == "Stack: 7 \n");
+
+    std::ostringstream unknown_out;
+    cbasic::Interpreter unknown(unknown_out);
+    unknown.load_library(": SQ DUP ;\n: SQPRINT ;\n");
+    CHECK(contains(eval(unknown, "SQ", unknown_out), "Unknown command 'DUP'"));
+    CHECK(eval(unknown, ": SQ 5 ;\nSQ SQPRINT PRINT", unknown_out) == "Stack: 5 \n");
+}
+
+// -----------------------------
+// Images and caches
+// -----------------------------
+cbasic::Code code_of(std::vector<cbasic::Instruction> instructions) {
+    cbasic::Code code;
+    code.instructions = std::move(instructions);
+    code.strings.push_back("label");
+    return code;
+}
+
+// Unbalanced loops and blocks, and operands out of range, are rejected
+void test_valid_code_rejects() {
+    using cbasic::Op;
+    using cbasic::Value;
+    auto valid = [](std::vector<cbasic::Instruction> instructions) {
+        return cbasic::valid_code(code_of(std::move(instructions)), 0, 1);
+    };
+    CHECK(valid({{Op::TimeBegin}, {Op::TimeEnd}}));
+    CHECK(!valid({{Op::TimeEnd}}));
+    CHECK(!valid({{Op::TimeBegin}}));
+    CHECK(!valid({{Op::BenchEnd, 0, 0}}));
+    CHECK(!valid({{Op::BenchBegin, 0, 0, Value::integer(3)}}));
+    CHECK(!valid({{Op::PerfEnd}}));
+    CHECK(!valid({{Op::Next, 0, 0}}));
+    CHECK(!valid({{Op::LoopIndex, 0}}));
+    CHECK(!valid({{Op::ALoadLoop, 0, 0}}));
+    // A loop's variable is only valid inside it
+    CHECK(valid({{Op::ForBegin, 0, 3}, {Op::LoopIndex, 0}, {Op::Next, 0, static_cast<std::uint32_t>(-1)}}));
+    CHECK(!valid({{Op::ForBegin, 0, 3}, {Op::LoopIndex, 1}, {Op::Next, 0, static_cast<std::uint32_t>(-1)}}));
+    CHECK(!valid({{Op::ForBegin, 0, 2}, {Op::Next, 0, 0}, {Op::LoopIndex, 0}}));
+    CHECK(!valid({{Op::Map, 0, 9}}));
+    CHECK(!valid({{Op::Zip, 0, 9}}));
+    CHECK(!valid({{Op::Reduce, 0, static_cast<std::uint32_t>(cbasic::ZipFn::Sub)}}));
+    CHECK(!valid({{Op::Filter, 0, 9}}));
+    CHECK(valid({{Op::Push, 0, 0, Value::array(0)}}));
+    CHECK(!valid({{Op::Push, 0, 0, Value::array(1)}}));
+}
+
+// A word in an image's dictionary compiles into any line, so one whose op
+// or operand is out of range, or that opens a block, refuses the image
+void test_image_rejects_bad_words() {
+    using cbasic::Op;
+    CHECK(cbasic::valid_word(Op::Add, 0, 0, 0));
+    CHECK(cbasic::valid_word(Op::ExecLocal, 0, 1, 0));
+    CHECK(!cbasic::valid_word(Op::ExecLocal, 1, 1, 0));
+    CHECK(!cbasic::valid_word(static_cast<Op>(cbasic::OP_COUNT), 0, 0, 0));
+    CHECK(!cbasic::valid_word(Op::ALoad, 1, 0, 1));
+    CHECK(!cbasic::valid_word(Op::Error, 0, 0, 0));
+    CHECK(!cbasic::valid_word(Op::TimeEnd, 0, 0, 0));
+    CHECK(!cbasic::valid_word(Op::ForBegin, 1, 0, 0));
+
+    const auto path = std::filesystem::temp_directory_path() / "cbasic_tests_words.img";
+    std::ostringstream out;
+    cbasic::Interpreter writer(out);
+    eval(writer, "DIM A(3)\n: ZZWORD ;\nSAVE-IMAGE " + path.string(), out);
+    std::string image;
+    {
+        std::ifstream file(path, std::ios::binary);
+        image.assign(std::istreambuf_iterator<char>(file), {});
+    }
+    // The word table comes last before the heap: the entry's op and arg
+    // follow the last copy of its name
+    const std::size_t entry = image.rfind("ZZWORD") + 6;
+    auto loads = [&](Op op, std::uint32_t arg) {
+        std::string patched = image;
+        patched[entry] = static_cast<char>(op);
+        std::memcpy(patched.data() + entry + 1, &arg, sizeof arg);
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << patched;
+        std::ostringstream loaded_out;
+        cbasic::Interpreter loaded(loaded_out);
+        return loaded.load_image(path.string());
+    };
+    CHECK(loads(Op::ExecLocal, 0));
+    CHECK(loads(Op::ALoad, 0));
+    CHECK(!loads(static_cast<Op>(200), 0));
+    CHECK(!loads(Op::ALoad, 1));
+    CHECK(!loads(Op::ExecLocal, 1));
+    CHECK(!loads(Op::SaveImage, 0));
+    CHECK(!loads(Op::Next, 0));
+    std::filesystem::remove(path);
+}
+
+// Everything the compiler emits survives an image round trip
+void test_image_round_trip() {
+    const auto path = std::filesystem::temp_directory_path() / "cbasic_tests.img";
+    std::ostringstream out;
+    cbasic::Interpreter writer(out);
+    eval(writer,
+         "DIM A(9) DIM B%(9)\n"
+         ": FILL FOR I = 0 TO 9 I TO A(I) I TO B%(I) NEXT ;\n"
+         ": NEST FOR I = 1 TO 2 FOR J = 1 TO 2 FOR K = 1 TO 2 FOR L = 1 TO 2 L NEXT NEXT NEXT NEXT ;\n"
+         ": REGROW FOR I = 0 TO 1 DIM C(3) A(I) TO C(I) NEXT ;\n"
+         ": PIPE A B% ZIP + MAP SQUARE ASUM A 5 FILTER < REDUCE MAX ;\n"
+         ": TIMED TIME{ 1 BENCH 3 { PERF{ 2 }PERF } }TIME ;\n"
+         "A 7\n"
+         "SAVE-IMAGE " + path.string(),
+         out);
+    std::ostringstream loaded_out;
+    cbasic::Interpreter loaded(loaded_out);
+    CHECK(loaded.load_image(path.string()));
+    const std::string expected = eval(writer, "FILL NEST REGROW PIPE PRINT", out);
+    CHECK(eval(loaded, "FILL NEST REGROW PIPE PRINT", loaded_out) == expected);
+    CHECK(writer.error_count() == 0);
+    CHECK(loaded.error_count() == 0);
+
+    // A truncated image is refused, not run
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) / 2);
+    std::ostringstream refused_out;
+    cbasic::Interpreter refused(refused_out);
+    CHECK(!refused.load_image(path.string()));
+    std::filesystem::remove(path);
+}
+
+// A cached script runs as it did when compiled
+void test_cache_round_trip() {
+    const auto dir = std::filesystem::temp_directory_path() / "cbasic_tests_cache";
+    std::filesystem::remove_all(dir);
+    const std::string script = "DIM A%(3) A% AIOTA\nFOR I = 0 TO 3 A%(I) NEXT PRINT\nTIME{ BENCH 2 { 1 } }TIME\n";
+    std::string first;
+    std::string second;
+    for (std::string* printed : {&first, &second}) {
+        std::ostringstream out;
+        cbasic::Interpreter interpreter(out);
+        interpreter.eval(script, dir);
+        interpreter.flush();
+        *printed = out.str();
+    }
+    CHECK(first.starts_with("Stack: 0 1 2 3 \nBENCH 1: 2 runs"));
+    CHECK(second.starts_with("Stack: 0 1 2 3 \nBENCH 1: 2 runs"));
+    // Entries are written under a temporary name and renamed into place
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+        CHECK(entry.path().extension() == ".cbc");
+    }
+    std::filesystem::remove_all(dir);
+}
+
+// -----------------------------
+// Timing words
+// -----------------------------
+// NOW is an integer however long the machine has been up
+void test_now_is_integer() {
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    eval(interpreter, "NOW NOW", out);
+    const auto& stack = interpreter.data_stack();
+    CHECK(stack.size() == 2);
+    CHECK(stack.size() == 2 && stack[0].is_int() && stack[1].is_int() && stack[0].as_int() <= stack[1].as_int());
+}
+
+// Nested TIME{ and BENCH blocks each push or report once, and every BENCH
+// run starts from the stack as it was at BENCH
+void test_time_bench_nesting() {
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    const std::string printed = eval(interpreter, ": T TIME{ BENCH 3 { TIME{ 1 }TIME } }TIME ;\n5 T", out);
+    const auto& stack = interpreter.data_stack();
+    CHECK(interpreter.error_count() == 0);
+    CHECK(stack.size() == 4);
+    CHECK(stack.size() == 4 && stack[0].as_int() == 5 && stack[1].as_int() == 1 && stack[2].is_int() &&
+          stack[3].is_int() && stack[3].as_int() >= stack[2].as_int());
+    CHECK(printed.starts_with("BENCH T: TIME{ 1 }TIME: 3 runs, min "));
+    CHECK(printed.find("BENCH", 1) == std::string::npos);
+}
+
+// -----------------------------
+// Word profiler
+// -----------------------------
+// The calls column of a PROFILE REPORT row, or -1 if `word` has no row
+long profiled_calls(const std::string& report, std::string_view word) {
+    std::istringstream rows(report);
+    for (std::string row; std::getline(rows, row);) {
+        std::istringstream fields(row);
+        std::string name;
+        long calls = -1;
+        if (fields >> name >> calls && name == word) {
+            return calls;
+        }
+    }
+    return -1;
+}
+
+// PROFILE counts calls while on, nests callees under their callers in the
+// folded stacks, and forgets everything on RESET
+void test_profile_report() {
+    const auto path = std::filesystem::temp_directory_path() / "cbasic_tests_profile.folded";
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    eval(interpreter, ": INNER FOR I = 1 TO 1000 NEXT 5 ;\n: OUTER INNER INNER ;\n"
+                      "OUTER PROFILE ON OUTER PROFILE OFF OUTER",
+         out);
+    const std::string report = eval(interpreter, "PROFILE REPORT", out);
+    CHECK(contains(report, "Profile:\n"));
+    CHECK(profiled_calls(report, "INNER") == 2);
+    CHECK(profiled_calls(report, "OUTER") == 1);
+
+    eval(interpreter, "PROFILE FOLDED " + path.string(), out);
+    std::ifstream folded(path);
+    std::vector<std::string> stacks;
+    for (std::string stack; std::getline(folded, stack);) {
+        stacks.push_back(stack.substr(0, stack.rfind(' ')));
+    }
+    CHECK(stacks.size() == 2);
+    CHECK(std::ranges::count(stacks, "OUTER") == 1 && std::ranges::count(stacks, "OUTER;INNER") == 1);
+    std::filesystem::remove(path);
+
+    CHECK(profiled_calls(eval(interpreter, "PROFILE RESET PROFILE REPORT", out), "INNER") == -1);
+    CHECK(contains(eval(interpreter, "PROFILE FOLDED " + (path / "missing" / "x").string(), out),
+                   "Error: PROFILE FOLDED cannot write"));
+    CHECK(interpreter.data_stack().size() == 6);
+}
+
+// When perf_event_open fails (here for want of file descriptors), PERF{ and
+// PROFILE fall back to times only and say why
+void test_perf_fallback() {
+#if defined(__linux__)
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    rlimit files{};
+    getrlimit(RLIMIT_NOFILE, &files);
+    rlimit none = files;
+    none.rlim_cur = 0;
+    setrlimit(RLIMIT_NOFILE, &none);
+    const bool counters = interpreter.perf_counters();
+    setrlimit(RLIMIT_NOFILE, &files);
+    CHECK(!counters);
+    CHECK(!interpreter.counters().available() && !interpreter.counters().reason().empty());
+
+    const std::string printed = eval(interpreter, "PERF{ 1 }PERF : ONE 1 ; ONE PROFILE REPORT", out);
+    CHECK(contains(printed, "PERF{ 1 }PERF: "));
+    CHECK(contains(printed, " (counters unavailable: perf_event_open: "));
+    CHECK(profiled_calls(printed, "ONE") == 1);
+    CHECK(interpreter.error_count() == 0);
+    CHECK(interpreter.data_stack().size() == 2);
+#endif
+}
+
+// -----------------------------
+// Sampling profiler
+// -----------------------------
+// Samples are attributed to the line running, numbered within its own
+// script or library
+void test_sample_attributes_lines() {
+    const auto path = std::filesystem::temp_directory_path() / "cbasic_tests.folded";
+    std::ostringstream out;
+    cbasic::Interpreter interpreter(out);
+    eval(interpreter, "SAMPLE ON\n: SPIN FOR I = 1 TO 3000000 NEXT ;\nSPIN", out);
+    interpreter.load_library("\nSPIN\n");
+    const std::string report = eval(interpreter, "SAMPLE REPORT", out);
+    eval(interpreter, "SAMPLE FOLDED " + path.string(), out);
+    CHECK(contains(report, "\nline 3 "));
+    CHECK(contains(report, "\nline 2 "));
+    std::ifstream folded(path);
+    std::string stack;
+    while (std::getline(folded, stack)) {
+        CHECK(stack.starts_with("line 3") || stack.starts_with("line 2"));
+    }
+    std::filesystem::remove(path);
+}
+
+// A job that turns on PROFILE or SAMPLE does not profile the jobs after
+// it on the same worker, whether they start afresh or from a snapshot
+void test_jobs_stop_profiling() {
+    cbasic::Interpreter start;
+    start.eval(": NOTHING ;");
+    for (bool from_snapshot : {false, true}) {
+        cbasic::JobOptions options;
+        options.workers = 1;
+        if (from_snapshot) {
+            options.start = start.snapshot();
+        }
+        auto results = cbasic::run_jobs({"PROFILE ON SAMPLE ON\n: W ;\nW", ": X ;\nX\nPROFILE REPORT\nSAMPLE REPORT"}, options);
+        CHECK(results.size() == 2);
+        CHECK(results[1].ok);
+        CHECK(contains(results[1].output, "Samples: 0 "));
+        CHECK(!contains(results[1].output, "\nW "));
+        CHECK(!contains(results[1].output, "\nX "));
+    }
+}
+
+} // namespace
+
+int main() {
+    test_parsers_at_runtime();
+    test_iequals();
+    test_utf8_validate();
+    test_error_positions();
+    test_value_tags();
+    test_value_arithmetic();
+    test_float_stack();
+    test_float_underflow();
+    test_interpreters_on_threads();
+    test_embedding();
+    test_jobs_order_and_isolation();
+    test_jobs_clear_released_memory();
+    test_jobs_restore_released_memory();
+    test_heap_round_trip();
+    test_heap_bounds();
+    test_loop_resize_keeps_checks();
+    test_adot_sizes();
+    test_array_store_load();
+    test_loop_bounds();
+    test_kernels();
+    test_pipeline_matches_eager();
+    test_filter_reduce();
+    test_share_and_shadow();
+    test_share_rejects_local_state();
+    test_fork_independence();
+    test_output_buffering();
+    test_output_color();
+    test_run_input_matches_eval();
+    test_run_input_last_line();
+    test_run_input_eof();
+    test_library_invalid_utf8();
+    test_library_unicode_spacing();
+    test_library_redefinition();
+    test_valid_code_rejects();
+    test_image_rejects_bad_words();
+    test_image_round_trip();
+    test_cache_round_trip();
+    test_now_is_integer();
+    test_time_bench_nesting();
+    test_perf_fallback();
+    test_profile_report();
+    test_sample_attributes_lines();
+    test_jobs_stop_profiling();
+    if (failures > 0) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace cbasic {
+
+// -----------------------------
+// Value
+// -----------------------------
+// A data stack cell, NaN-boxed into 8 bytes.
+//
+// Any bit pattern whose top 16 bits are below 0xFFF9 is an IEEE double (NaNs
+// produced by arithmetic are canonicalized so they never collide with boxed
+// values). Patterns 0xFFF9..0xFFFF in the top 16 bits carry a 3-bit tag and a
+// 48-bit payload:
+//
+//   0xFFF9  Int     48-bit two's complement integer
+//   0xFFFA  Array   reference to a DIM or temporary array, by number
+//   0xFFFB  Expr    reference to a lazy array expression, by node number
+//
+// The remaining tags are reserved for further references (strings, ...).
+// Integer results that do not fit in 48 bits become doubles, which represent
+// them exactly up to 2^53.
+class Value {
+public:
+    enum class Type : std::uint8_t { Float, Int, Array, Expr };
+
+    static constexpr std::uint64_t TAG_SHIFT = 48;
+    static constexpr std::uint64_t PAYLOAD_MASK = (std::uint64_t{1} << TAG_SHIFT) - 1;
+    static constexpr std::uint64_t INT_TAG = std::uint64_t{0xFFF9} << TAG_SHIFT;
+    static constexpr std::uint64_t ARRAY_TAG = std::uint64_t{0xFFFA} << TAG_SHIFT;
+    static constexpr std::uint64_t EXPR_TAG = std::uint64_t{0xFFFB} << TAG_SHIFT;
+    static constexpr std::int64_t INT_MIN = -(std::int64_t{1} << 47);
+    static constexpr std::int64_t INT_MAX = (std::int64_t{1} << 47) - 1;
+    static constexpr std::uint64_t CANONICAL_NAN = 0x7FF8'0000'0000'0000;
+
+    constexpr Value() : bits_(INT_TAG) {}
+
+    // An integer, or the nearest double if it does not fit in 48 bits
+    static constexpr Value integer(std::int64_t v) {
+        if (v < INT_MIN || v > INT_MAX) {
+            return real(static_cast<double>(v));
+        }
+        return from_bits(INT_TAG | (static_cast<std::uint64_t>(v) & PAYLOAD_MASK));
+    }
+
+    static constexpr Value array(std::uint32_t id) {
+        return from_bits(ARRAY_TAG | id);
+    }
+
+    static constexpr Value expr(std::uint32_t node) {
+        return from_bits(EXPR_TAG | node);
+    }
+
+    static constexpr Value real(double d) {
+        if (d != d) {
+            return from_bits(CANONICAL_NAN);
+        }
+        return from_bits(std::bit_cast<std::uint64_t>(d));
+    }
+
+    static constexpr Value from_bits(std::uint64_t bits) {
+        Value v;
+        v.bits_ = bits;
+        return v;
+    }
+
+    constexpr std::uint64_t bits() const { return bits_; }
+
+    constexpr bool is_int() const { return (bits_ >> TAG_SHIFT) == (INT_TAG >> TAG_SHIFT); }
+    constexpr bool is_float() const { return (bits_ >> TAG_SHIFT) < (INT_TAG >> TAG_SHIFT); }
+    constexpr bool is_array() const { return (bits_ >> TAG_SHIFT) == (ARRAY_TAG >> TAG_SHIFT); }
+    constexpr bool is_expr() const { return (bits_ >> TAG_SHIFT) == (EXPR_TAG >> TAG_SHIFT); }
+    // Any reference tag: Array, Expr or one added later
+    constexpr bool is_reference() const { return (bits_ >> TAG_SHIFT) >= (ARRAY_TAG >> TAG_SHIFT); }
+    constexpr Type type() const {
+        return is_int() ? Type::Int : is_array() ? Type::Array : is_expr() ? Type::Expr : Type::Float;
+    }
+
+    // Sign-extend the 48-bit payload
+    constexpr std::int64_t as_int() const {
+        return static_cast<std::int64_t>(bits_ << 16) >> 16;
+    }
+
+    constexpr double as_float() const { return std::bit_cast<double>(bits_); }
+
+    constexpr std::uint32_t as_array() const { return static_cast<std::uint32_t>(bits_); }
+
+    constexpr std::uint32_t as_expr() const { return static_cast<std::uint32_t>(bits_); }
+
+    constexpr double to_double() const {
+        return is_int() ? static_cast<double>(as_int()) : as_float();
+    }
+
+    // Floats are truncated toward zero
+    constexpr std::int64_t to_int() const {
+        return is_int() ? as_int() : static_cast<std::int64_t>(as_float());
+    }
+
+    // True when both are Int; one test on the combined tag bits, so the
+    // int-int case of arithmetic costs a single branch.
+    friend constexpr bool both_int(Value a, Value b) {
+        return ((a.bits_ ^ INT_TAG) | (b.bits_ ^ INT_TAG)) >> TAG_SHIFT == 0;
+    }
+
+    // Shortest round-trip text, locale-independent
+    std::string_view format(char (&buffer)[32]) const {
+        if (is_array() || is_expr()) {
+            const std::string_view prefix = is_array() ? "<array " : "<expr ";
+            prefix.copy(buffer, prefix.size());
+            auto r = std::to_chars(buffer + prefix.size(), buffer + sizeof buffer - 1, static_cast<std::uint32_t>(bits_));
+            *r.ptr++ = '>';
+            return {buffer, static_cast<std::size_t>(r.ptr - buffer)};
+        }
+        auto r = is_int() ? std::to_chars(buffer, buffer + sizeof buffer, as_int())
+                          : std::to_chars(buffer, buffer + sizeof buffer, as_float());
+        return {buffer, static_cast<std::size_t>(r.ptr - buffer)};
+    }
+
+    friend std::ostream& operator<<(std::ostream& out, Value v) {
+        char buffer[32];
+        return out << v.format(buffer);
+    }
+
+    friend std::string to_string(Value v) {
+        char buffer[32];
+        return std::string(v.format(buffer));
+    }
+
+private:
+    std::uint64_t bits_;
+};
+
+static_assert(sizeof(Value) == 8, "Value must stay one 8-byte cell");
+
+// Parse a numeric literal. Integers ("42", "-7") become Int; literals with a
+// fraction or exponent ("2.5", "1e3") become Float. The whole word must be
+// consumed, and it must start with a digit, '-' or '.' followed by a digit,
+// so words such as "nan", "inf" or "-" stay words.
+inline std::optional<Value> parse_number(std::string_view word) {
+    std::size_t i = word.starts_with('-') ? 1 : 0;
+    if (i < word.size() && word[i] == '.') {
+        ++i;
+    }
+    if (i >= word.size() || word[i] < '0' || word[i] > '9') {
+        return std::nullopt;
+    }
+    const char* first = word.data();
+    const char* last = first + word.size();
+    std::int64_t i64 = 0;
+    if (auto r = std::from_chars(first, last, i64); r.ec == std::errc{} && r.ptr == last) {
+        return Value::integer(i64);
+    }
+    double d = 0;
+    if (auto r = std::from_chars(first, last, d); r.ec == std::errc{} && r.ptr == last) {
+        return Value::real(d);
+    }
+    return std::nullopt;
+}
+
+} // namespace cbasic